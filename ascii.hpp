@@ -0,0 +1,394 @@
+#pragma once
+
+#include "renderer.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+const float COLOR_FACTOR = 1.2;
+const float BRIGHTNESS_FACTOR = 0.3;
+
+inline const char* intensityToChar(double i) {
+    i = 1.0 - i;
+    // static const std::string chars = " .:-+#%@";
+    static const std::string chars = "$@B%8&WM#*oahkbdpqwmZO0QLCJUYXzcvunxrjft/|()1{}[]?-_+~<>i!lI;:,. ";
+    int index = static_cast<int>(i * (chars.size() - 1) + 0.5);
+    if (index < 0) index = 0;
+    if (index >= static_cast<int>(chars.size())) index = static_cast<int>(chars.size()) - 1;
+    static char buf[2] = {0};
+    buf[0] = chars[index];
+    return buf;
+}
+
+// One character cell. Colors are 0xRRGGBB, PALETTE | index for the
+// terminal's 256-color palette, ANSI | index for the 16 basic colors, or
+// DEFAULT for whatever the terminal's own foreground/background is.
+struct Cell {
+    static constexpr uint32_t PALETTE = 1u << 24;
+    static constexpr uint32_t ANSI = 2u << 24;
+    static constexpr uint32_t DEFAULT = 0xffffffffu;
+
+    uint32_t fg = 0, bg = 0;
+    char glyph = ' ';
+
+    bool operator==(const Cell& o) const { return fg == o.fg && bg == o.bg && glyph == o.glyph; }
+    bool operator!=(const Cell& o) const { return !(*this == o); }
+};
+
+struct AsciiFrame {
+    int width = 0, height = 0;
+    std::vector<Cell> cells;
+
+    const Cell& at(int x, int y) const { return cells[y * width + x]; }
+};
+
+enum class ColorMode { TrueColor, Xterm256, Ansi16, Mono };
+
+inline bool parseColorMode(const std::string& name, ColorMode& mode) {
+    if (name == "truecolor" || name == "24bit") mode = ColorMode::TrueColor;
+    else if (name == "256") mode = ColorMode::Xterm256;
+    else if (name == "16") mode = ColorMode::Ansi16;
+    else if (name == "mono") mode = ColorMode::Mono;
+    else return false;
+    return true;
+}
+
+// Nearest-palette-entry tables indexed by RGB reduced to 5 bits per channel,
+// so quantizing a color is one load instead of a distance search
+struct ColorTables {
+    uint8_t xterm256[1 << 15];
+    uint8_t ansi16[1 << 15];
+
+    static const ColorTables& get() {
+        static const ColorTables tables;
+        return tables;
+    }
+
+    static int key(uint32_t rgb) { return (rgb >> 19 & 31) << 10 | (rgb >> 11 & 31) << 5 | (rgb >> 3 & 31); }
+
+    // Values the xterm palette uses for the 6x6x6 cube and the 16 basic colors
+    static int cubeLevel(int i) { return i == 0 ? 0 : 55 + i * 40; }
+
+    static uint32_t ansiColor(int i) {
+        static const uint32_t colors[16] = {
+            0x000000, 0xcd0000, 0x00cd00, 0xcdcd00, 0x0000ee, 0xcd00cd, 0x00cdcd, 0xe5e5e5,
+            0x7f7f7f, 0xff0000, 0x00ff00, 0xffff00, 0x5c5cff, 0xff00ff, 0x00ffff, 0xffffff,
+        };
+        return colors[i];
+    }
+
+    ColorTables() {
+        // The cube is a grid, so its nearest entry is the nearest level per
+        // channel; the nearest gray is the one nearest the channel mean.
+        uint8_t nearestLevel[256];
+        for (int v = 0; v < 256; v++) {
+            int best = 0;
+            for (int i = 1; i < 6; i++)
+                if (std::abs(cubeLevel(i) - v) < std::abs(cubeLevel(best) - v)) best = i;
+            nearestLevel[v] = static_cast<uint8_t>(best);
+        }
+
+        for (int k = 0; k < (1 << 15); k++) {
+            int rgb[3] = {(k >> 10 & 31) << 3 | 4, (k >> 5 & 31) << 3 | 4, (k & 31) << 3 | 4};
+
+            int cube[3], cubeDist = 0;
+            for (int c = 0; c < 3; c++) {
+                cube[c] = nearestLevel[rgb[c]];
+                int d = cubeLevel(cube[c]) - rgb[c];
+                cubeDist += d * d;
+            }
+            int mean = (rgb[0] + rgb[1] + rgb[2]) / 3;
+            int gray = std::max(0, std::min(23, (mean - 8 + 5) / 10));
+            int grayDist = 0;
+            for (int c = 0; c < 3; c++) {
+                int d = 8 + gray * 10 - rgb[c];
+                grayDist += d * d;
+            }
+            xterm256[k] = static_cast<uint8_t>(grayDist < cubeDist ? 232 + gray
+                                                                   : 16 + cube[0] * 36 + cube[1] * 6 + cube[2]);
+
+            int best = 0, bestDist = 1 << 30;
+            for (int i = 0; i < 16; i++) {
+                uint32_t a = ansiColor(i);
+                int dr = static_cast<int>(a >> 16) - rgb[0];
+                int dg = static_cast<int>(a >> 8 & 0xff) - rgb[1];
+                int db = static_cast<int>(a & 0xff) - rgb[2];
+                int dist = dr * dr + dg * dg + db * db;
+                if (dist < bestDist) {
+                    best = i;
+                    bestDist = dist;
+                }
+            }
+            ansi16[k] = static_cast<uint8_t>(best);
+        }
+    }
+};
+
+// Map a truecolor or grayscale-palette color into what the mode can display
+inline uint32_t quantizeColor(uint32_t color, ColorMode mode, const ColorTables& tables) {
+    switch (mode) {
+    case ColorMode::TrueColor:
+        return color;
+    case ColorMode::Xterm256:
+        return color & Cell::PALETTE ? color : Cell::PALETTE | tables.xterm256[ColorTables::key(color)];
+    case ColorMode::Ansi16:
+        if (color & Cell::PALETTE) color = (8 + 10 * ((color & 0xff) - 232)) * 0x010101u;
+        return Cell::ANSI | tables.ansi16[ColorTables::key(color)];
+    case ColorMode::Mono:
+        break;
+    }
+    return Cell::DEFAULT;
+}
+
+// Downsample the rendered frame to character cells (2x1 pixels per cell)
+inline void buildAsciiFrame(const FrameBuffer& frame, AsciiFrame& out, ColorMode mode = ColorMode::TrueColor) {
+    const int charWidth = 2, charHeight = 1;
+    const ColorTables& tables = ColorTables::get();
+    out.width = frame.width / charWidth;
+    out.height = frame.height / charHeight;
+    out.cells.resize(static_cast<size_t>(out.width) * out.height);
+
+    for (int y = 0; y < out.height; y++) {
+        for (int x = 0; x < out.width; x++) {
+            double sumR = 0, sumG = 0, sumB = 0, sumI = 0;
+            int count = 0;
+            bool anyColor = false;
+            for (int dy = 0; dy < charHeight; dy++) {
+                for (int dx = 0; dx < charWidth; dx++) {
+                    int px = x * charWidth + dx;
+                    int py = y * charHeight + dy;
+                    if (px < frame.width && py < frame.height && frame.covered(px, py)) {
+                        int idx = py * frame.width + px;
+                        if (frame.hasColor) {
+                            uint32_t c = frame.color[idx];
+                            sumR += (c >> 16 & 0xff) / 255.0;
+                            sumG += (c >> 8 & 0xff) / 255.0;
+                            sumB += (c & 0xff) / 255.0;
+                            anyColor = true;
+                        } else {
+                            sumI += frame.intensity[idx] / 255.0;
+                        }
+                        count++;
+                    }
+                }
+            }
+
+            Cell& cell = out.cells[y * out.width + x];
+            if (count == 0) {
+                cell.fg = cell.bg = 0;
+                cell.glyph = intensityToChar(0)[0];
+            } else if (anyColor) {
+                int r = std::min(255, std::max(0, static_cast<int>((sumR / count) * 255 * COLOR_FACTOR)));
+                int g = std::min(255, std::max(0, static_cast<int>((sumG / count) * 255 * COLOR_FACTOR)));
+                int b = std::min(255, std::max(0, static_cast<int>((sumB / count) * 255 * COLOR_FACTOR)));
+                int br = std::min(255, std::max(0, static_cast<int>(r * BRIGHTNESS_FACTOR)));
+                int bg = std::min(255, std::max(0, static_cast<int>(g * BRIGHTNESS_FACTOR)));
+                int bb = std::min(255, std::max(0, static_cast<int>(b * BRIGHTNESS_FACTOR)));
+                double avg = (r + g + b) / (255.0 * 3);
+                cell.fg = r << 16 | g << 8 | b;
+                cell.bg = br << 16 | bg << 8 | bb;
+                cell.glyph = intensityToChar(avg)[0];
+            } else {
+                double avg = sumI / count;
+                int level = std::max(0, std::min(5, static_cast<int>(avg * 5)));
+                int gray = std::min(255, 232 + level * 4);
+                int bgGray = std::max(232, gray - 12);
+                cell.fg = Cell::PALETTE | gray;
+                cell.bg = Cell::PALETTE | bgGray;
+                cell.glyph = intensityToChar(avg)[0];
+            }
+            if (mode != ColorMode::TrueColor) {
+                cell.fg = quantizeColor(cell.fg, mode, tables);
+                cell.bg = quantizeColor(cell.bg, mode, tables);
+            }
+        }
+    }
+}
+
+// Growable byte buffer that keeps its storage between frames, with
+// locale-free integer formatting
+class OutputBuffer {
+public:
+    explicit OutputBuffer(size_t reserveBytes = 1 << 16) { buf.resize(reserveBytes); }
+
+    void clear() { len = 0; }
+    const char* data() const { return buf.data(); }
+    size_t size() const { return len; }
+
+    void put(char c) {
+        reserve(1);
+        buf[len++] = c;
+    }
+
+    void append(const char* s, size_t n) {
+        reserve(n);
+        std::memcpy(&buf[len], s, n);
+        len += n;
+    }
+
+    void append(const char* s) { append(s, std::strlen(s)); }
+    void append(const std::string& s) { append(s.data(), s.size()); }
+
+    void appendUint(uint32_t v) {
+        static const char pairs[] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+        char tmp[10];
+        char* p = tmp + sizeof(tmp);
+        while (v >= 100) {
+            p -= 2;
+            std::memcpy(p, pairs + (v % 100) * 2, 2);
+            v /= 100;
+        }
+        if (v >= 10) {
+            p -= 2;
+            std::memcpy(p, pairs + v * 2, 2);
+        } else {
+            *--p = static_cast<char>('0' + v);
+        }
+        append(p, tmp + sizeof(tmp) - p);
+    }
+
+    // Write everything to stdout with as few system calls as the OS allows
+    bool writeToStdout() const {
+        size_t done = 0;
+        while (done < len) {
+#ifdef _WIN32
+            int n = _write(1, buf.data() + done, static_cast<unsigned>(std::min<size_t>(len - done, 1u << 30)));
+            if (n <= 0) return false;
+#else
+            ssize_t n = ::write(STDOUT_FILENO, buf.data() + done, len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+#endif
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+private:
+    std::vector<char> buf;
+    size_t len = 0;
+
+    void reserve(size_t n) {
+        if (len + n > buf.size()) buf.resize(std::max(buf.size() * 2, len + n));
+    }
+};
+
+// Turns AsciiFrames into terminal output. After the first full frame only
+// cells that differ from what is on screen are sent, addressed with cursor
+// movement, and SGR color codes are only emitted when the color changes.
+class TerminalPresenter {
+public:
+    // Encode frame plus status lines starting one row below it (info, then
+    // any extra lines); returns the bytes to write. Storage is reused, so
+    // steady-state frames do not allocate.
+    const OutputBuffer& present(const AsciiFrame& frame, const std::string& info,
+                                const std::vector<std::string>& extra = {}) {
+        out.clear();
+        bool full = !valid || frame.width != shown.width || frame.height != shown.height;
+        if (full) {
+            out.append("\033[0m\033[2J\033[H");
+            curX = curY = 0;
+            curFg = curBg = Cell::DEFAULT;
+        }
+
+        for (int y = 0; y < frame.height; y++) {
+            for (int x = 0; x < frame.width; x++) {
+                const Cell& c = frame.at(x, y);
+                if (!full && c == shown.at(x, y)) continue;
+                moveTo(x, y);
+                setColors(c.fg, c.bg);
+                out.put(c.glyph);
+                curX++;
+            }
+        }
+
+        // Lines that were shown before but are no longer passed get blanked
+        if (shownStatus.size() < extra.size() + 1) shownStatus.resize(extra.size() + 1);
+        for (size_t i = 0; i < shownStatus.size(); i++) {
+            const std::string& text = i == 0 ? info : i <= extra.size() ? extra[i - 1] : noText;
+            if (!full && text == shownStatus[i]) continue;
+            moveTo(0, frame.height + 1 + static_cast<int>(i));
+            out.append("\033[0m");
+            curFg = curBg = Cell::DEFAULT;
+            out.append(text);
+            out.append("\033[K");
+            curX = -1;  // column depends on how the terminal measured the text
+            shownStatus[i] = text;
+        }
+
+        shown = frame;
+        valid = true;
+        return out;
+    }
+
+    // Force the next frame to be drawn in full, e.g. after the screen was cleared
+    void invalidate() { valid = false; }
+
+private:
+    AsciiFrame shown;
+    std::vector<std::string> shownStatus;
+    const std::string noText;
+    bool valid = false;
+    OutputBuffer out;
+    int curX = 0, curY = 0;
+    uint32_t curFg = Cell::DEFAULT, curBg = Cell::DEFAULT;
+
+    void moveTo(int x, int y) {
+        if (x == curX && y == curY) return;
+        out.append("\033[");
+        if (y == curY && curX >= 0 && x > curX) {
+            out.appendUint(x - curX);
+            out.put('C');
+        } else {
+            out.appendUint(y + 1);
+            out.put(';');
+            out.appendUint(x + 1);
+            out.put('H');
+        }
+        curX = x;
+        curY = y;
+    }
+
+    void appendColor(bool foreground, uint32_t color) {
+        if (color == Cell::DEFAULT) {
+            out.append(foreground ? "39" : "49", 2);
+        } else if (color & Cell::ANSI) {
+            uint32_t index = color & 0xf;
+            out.appendUint((index < 8 ? 30 : 82) + (foreground ? 0 : 10) + index);
+        } else if (color & Cell::PALETTE) {
+            out.append(foreground ? "38;5;" : "48;5;", 5);
+            out.appendUint(color & 0xff);
+        } else {
+            out.append(foreground ? "38;2;" : "48;2;", 5);
+            out.appendUint(color >> 16 & 0xff);
+            out.put(';');
+            out.appendUint(color >> 8 & 0xff);
+            out.put(';');
+            out.appendUint(color & 0xff);
+        }
+    }
+
+    void setColors(uint32_t fg, uint32_t bg) {
+        if (fg == curFg && bg == curBg) return;
+        out.append("\033[", 2);
+        if (fg != curFg) appendColor(true, fg);
+        if (fg != curFg && bg != curBg) out.put(';');
+        if (bg != curBg) appendColor(false, bg);
+        out.put('m');
+        curFg = fg;
+        curBg = bg;
+    }
+};
@@ -0,0 +1,527 @@
+// viewer_bench: throughput benchmarks for the viewer's hot paths.
+// Usage: viewer_bench [file.obj]   (defaults to example/rose.obj)
+//        viewer_bench --micro[=FILTER]   micro-benchmarks only, optionally
+//                                        those whose name contains FILTER
+//        viewer_bench --check            compare Mesh::load with the reference
+//                                        loader, chunked multithreaded loads
+//                                        with serial ones and the float vertex
+//                                        stage with double; exits 1 on a mismatch
+
+#include "obj_parser.hpp"
+#include "renderer.hpp"
+#include "lod.hpp"
+#include "ascii.hpp"
+#include "profile.hpp"
+#include "microbench.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef VIEWER_EXAMPLE_DIR
+#define VIEWER_EXAMPLE_DIR "example"
+#endif
+
+// UV sphere with 2 * rings * segments triangles, without render data
+static Mesh makeSphere(int rings, int segments) {
+    Mesh mesh;
+    for (int r = 0; r <= rings; r++) {
+        double theta = 3.14159265 * r / rings;
+        for (int s = 0; s <= segments; s++) {
+            double phi = 2 * 3.14159265 * s / segments;
+            mesh.vertices.push_back(Vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+        }
+    }
+    for (int r = 0; r < rings; r++) {
+        for (int s = 0; s < segments; s++) {
+            int a = r * (segments + 1) + s, b = a + segments + 1;
+            Triangle t0, t1;
+            t0.v0 = a; t0.v1 = a + 1; t0.v2 = b;
+            t1.v0 = a + 1; t1.v1 = b + 1; t1.v2 = b;
+            mesh.triangles.push_back(t0);
+            mesh.triangles.push_back(t1);
+        }
+    }
+    return mesh;
+}
+
+// ClusterBvh::build on a copy of mesh, which should not be built yet
+static void benchClusterBuild(const char* name, const Mesh& mesh, unsigned threads) {
+    const int repeats = 5;
+    double total = 0;
+    size_t clusters = 0;
+    for (int r = 0; r < repeats; r++) {
+        std::vector<Vec3> vertices = mesh.vertices;
+        std::vector<Triangle> triangles = mesh.triangles;
+        ClusterBvh bvh;
+        double start = nowSeconds();
+        bvh.build(vertices, triangles, threads);
+        total += nowSeconds() - start;
+        clusters = bvh.clusters.size();
+    }
+    std::printf("cluster build %s: %zu triangles, %zu clusters, %u threads  %8.3f ms\n", name,
+                mesh.triangles.size(), clusters, threads, total / repeats * 1e3);
+}
+
+// Same normalisation and camera as the interactive viewer
+static Mat4 orbitViewProj(const Mesh& mesh, double rotY, double cameraDist) {
+    Vec3 minV, maxV;
+    mesh.bounds(minV, maxV);
+    Vec3 center = (minV + maxV) * 0.5;
+    double size = std::max({maxV.x - minV.x, maxV.y - minV.y, maxV.z - minV.z});
+    if (size < 1e-6) size = 1.0;
+    Mat4 proj = Mat4::perspective(45, 1.5, 0.1, 100);
+    Mat4 view = Mat4::lookAt(Vec3(0, 0, cameraDist), Vec3(0, 0, 0), Vec3(0, 1, 0));
+    Mat4 model = Mat4::rotateY(rotY) * Mat4::scale(2.0 / size) * Mat4::translate(Vec3(-center.x, -center.y, -center.z));
+    return proj * view * model;
+}
+
+// LodChain::build on mesh, then the level drawn at each distance
+static void benchLodBuild(const char* name, const Mesh& mesh, int width, int height) {
+    const int repeats = 3;
+    LodChain lods;
+    double start = nowSeconds();
+    for (int r = 0; r < repeats; r++) lods.build(mesh);
+    std::printf("lod build %s: %8.3f ms\n", name, (nowSeconds() - start) / repeats * 1e3);
+    for (size_t i = 0; i < lods.levels(); i++)
+        std::printf("  level %zu: %8zu triangles, error %.2e\n", i, lods.level(i).triangles.size(), lods.error(i));
+    for (double dist : {1.5, 3.0, 6.0, 12.0})
+        std::printf("  distance %4.1f at %dx%d draws level %zu\n", dist, width, height,
+                    lods.select(orbitViewProj(mesh, 0, dist), width, height));
+}
+
+static void benchRaster(const char* name, const Mesh& mesh, int width, int height, double cameraDist) {
+    const int frames = 24;
+    std::printf("raster %s: %zu triangles, %dx%d, distance %.1f\n", name, mesh.triangles.size(),
+                width, height, cameraDist);
+    struct Config { const char* label; bool simd, coarse, cull, smallTris; };
+    const Config configs[] = {{"scalar", false, true, true, true}, {"avx", true, true, true, true},
+                              {"no-hiz", true, false, true, true}, {"no-cull", true, true, false, true},
+                              {"no-small", true, true, true, false}};
+    for (const Config& config : configs) {
+        Renderer renderer(width, height);
+        renderer.setSimd(config.simd);
+        renderer.setCoarseDepth(config.coarse);
+        renderer.setClusterCulling(config.cull);
+        renderer.setSmallTriangles(config.smallTris);
+        if (config.simd && !renderer.simdEnabled()) {
+            std::printf("  %-8s unavailable on this CPU\n", config.label);
+            continue;
+        }
+        renderer.viewProj = orbitViewProj(mesh, 0, cameraDist);
+        renderer.render(mesh);
+
+        RasterStats total;
+        double start = nowSeconds();
+        for (int f = 0; f < frames; f++) {
+            renderer.viewProj = orbitViewProj(mesh, f * 2 * 3.14159265 / frames, cameraDist);
+            renderer.render(mesh);
+            total.add(renderer.stats);
+        }
+        double elapsed = nowSeconds() - start;
+        std::printf("  %-8s %8.3f ms/frame %8.2f M triangles/s", config.label,
+                    elapsed / frames * 1e3, mesh.triangles.size() * frames / elapsed / 1e6);
+        if (config.coarse && total.blocksTested > 0)
+            std::printf("  hiz: %.1f%% triangles, %.1f%% blocks rejected",
+                        100.0 * total.trianglesRejected / total.trianglesTested,
+                        100.0 * total.blocksRejected / total.blocksTested);
+        if (config.smallTris && total.trianglesTested > 0)
+            std::printf("  small: %.1f%% triangles", 100.0 * total.trianglesSmall / total.trianglesTested);
+        if (config.cull && !mesh.clusters.empty())
+            std::printf("  clusters: %.1f%% culled",
+                        100.0 * total.clustersCulled / (mesh.clusters.clusters.size() * frames));
+        std::printf("\n");
+    }
+}
+
+// Cell conversion and escape-sequence encoding, excluding rasterization
+static void benchEncode(const char* name, const Mesh& mesh, int width, int height,
+                        ColorMode mode = ColorMode::TrueColor, const char* modeName = "truecolor") {
+    const int frames = 24, repeats = 20;
+    Renderer renderer(width, height);
+    std::vector<AsciiFrame> asciiFrames(frames);
+    for (int f = 0; f < frames; f++) {
+        renderer.viewProj = orbitViewProj(mesh, f * 0.05, 3.0);
+        renderer.render(mesh);
+        buildAsciiFrame(renderer.frame, asciiFrames[f], mode);
+    }
+
+    AsciiFrame scratch;
+    double start = nowSeconds();
+    for (int r = 0; r < repeats; r++) buildAsciiFrame(renderer.frame, scratch, mode);
+    double build = (nowSeconds() - start) / repeats;
+
+    const std::string info = "[AD] Rotate, [WS] Zoom, [ESC] Exit";
+    TerminalPresenter presenter;
+    size_t fullBytes = 0, diffBytes = 0;
+    start = nowSeconds();
+    for (int r = 0; r < repeats; r++) {
+        for (int f = 0; f < frames; f++) {
+            presenter.invalidate();
+            fullBytes += presenter.present(asciiFrames[f], info).size();
+        }
+    }
+    double full = (nowSeconds() - start) / (repeats * frames);
+
+    start = nowSeconds();
+    for (int r = 0; r < repeats; r++) {
+        presenter.invalidate();
+        presenter.present(asciiFrames[frames - 1], info);
+        for (int f = 0; f < frames; f++) diffBytes += presenter.present(asciiFrames[f], info).size();
+    }
+    double diff = (nowSeconds() - start) / (repeats * frames);
+
+    std::printf("encode %s: %dx%d cells, %s\n", name, asciiFrames[0].width, asciiFrames[0].height, modeName);
+    std::printf("  cells    %8.3f ms/frame\n", build * 1e3);
+    std::printf("  full     %8.3f ms/frame %8zu bytes/frame %8.0f MB/s\n", full * 1e3,
+                fullBytes / (repeats * frames), fullBytes / (repeats * frames) / full / 1e6);
+    std::printf("  diff     %8.3f ms/frame %8zu bytes/frame\n", diff * 1e3, diffBytes / (repeats * frames));
+}
+
+// Micro-benchmarks. Inputs cycle through small precomputed tables so the
+// compiler cannot fold them, without adding much beyond an L1 load.
+
+static const int INPUTS = 256;
+
+static double randomUnit() {
+    static uint32_t seed = 12345;
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0;
+}
+
+static std::vector<Vec3> randomVectors() {
+    std::vector<Vec3> v(INPUTS);
+    for (Vec3& p : v) p = Vec3(randomUnit() * 2 - 1, randomUnit() * 2 - 1, randomUnit() * 2 - 1);
+    return v;
+}
+
+static std::vector<Mat4> randomMatrices() {
+    std::vector<Mat4> v(INPUTS);
+    for (int i = 0; i < INPUTS; i++)
+        v[i] = Mat4::perspective(45, 1.5, 0.1, 100) * Mat4::rotateY(randomUnit() * 6.28) *
+               Mat4::translate(Vec3(randomUnit(), randomUnit(), randomUnit() - 3));
+    return v;
+}
+
+static void BM_Mat4Multiply(BenchState& state) {
+    std::vector<Mat4> a = randomMatrices(), b = randomMatrices();
+    unsigned i = 0;
+    for ([[maybe_unused]] auto _ : state) {
+        doNotOptimize(a[i % INPUTS] * b[(i + 7) % INPUTS]);
+        i++;
+    }
+}
+MICRO_BENCHMARK(BM_Mat4Multiply);
+
+static void BM_Mat4TransformPoint(BenchState& state) {
+    std::vector<Mat4> m = randomMatrices();
+    std::vector<Vec3> p = randomVectors();
+    unsigned i = 0;
+    for ([[maybe_unused]] auto _ : state) {
+        doNotOptimize(m[0].transformPoint(p[i % INPUTS]));
+        i++;
+    }
+}
+MICRO_BENCHMARK(BM_Mat4TransformPoint);
+
+// Per-vertex cost of the renderer's batched single-precision transform
+static void BM_Mat4fTransformPoints(BenchState& state) {
+    Mat4f m(randomMatrices()[0]);
+    std::vector<Vec3f> in, out(INPUTS);
+    for (const Vec3& p : randomVectors()) in.push_back(Vec3f(p));
+    for ([[maybe_unused]] auto _ : state) {
+        m.transformPoints(in.data(), out.data(), 1);
+        doNotOptimize(out[0]);
+    }
+}
+MICRO_BENCHMARK(BM_Mat4fTransformPoints);
+
+static void BM_Mat4fTransformPoints256(BenchState& state) {
+    Mat4f m(randomMatrices()[0]);
+    std::vector<Vec3f> in, out(INPUTS);
+    for (const Vec3& p : randomVectors()) in.push_back(Vec3f(p));
+    for ([[maybe_unused]] auto _ : state) {
+        m.transformPoints(in.data(), out.data(), INPUTS);
+        doNotOptimize(out[INPUTS - 1]);
+    }
+}
+MICRO_BENCHMARK(BM_Mat4fTransformPoints256);
+
+static void BM_Mat4fTransformClip256(BenchState& state) {
+    Mat4f m(randomMatrices()[0]);
+    std::vector<Vec3f> in;
+    std::vector<Vec4f> out(INPUTS);
+    for (const Vec3& p : randomVectors()) in.push_back(Vec3f(p));
+    for ([[maybe_unused]] auto _ : state) {
+        m.transformPoints(in.data(), out.data(), INPUTS);
+        doNotOptimize(out[INPUTS - 1]);
+    }
+}
+MICRO_BENCHMARK(BM_Mat4fTransformClip256);
+
+static void BM_Mat4TransformClip256(BenchState& state) {
+    Mat4 m = randomMatrices()[0];
+    std::vector<Vec3> in = randomVectors();
+    std::vector<Vec4> out(INPUTS);
+    for ([[maybe_unused]] auto _ : state) {
+        m.transformPoints(in.data(), out.data(), INPUTS);
+        doNotOptimize(out[INPUTS - 1]);
+    }
+}
+MICRO_BENCHMARK(BM_Mat4TransformClip256);
+
+static void BM_NormalizeVectors256(BenchState& state) {
+    std::vector<Vec3f> in, v(INPUTS);
+    for (const Vec3& p : randomVectors()) in.push_back(Vec3f(p));
+    for ([[maybe_unused]] auto _ : state) {
+        std::copy(in.begin(), in.end(), v.begin());
+        normalizeVectors(v.data(), INPUTS);
+        doNotOptimize(v[INPUTS - 1]);
+    }
+}
+MICRO_BENCHMARK(BM_NormalizeVectors256);
+
+static void BM_Vec3Normalized(BenchState& state) {
+    std::vector<Vec3> p = randomVectors();
+    unsigned i = 0;
+    for ([[maybe_unused]] auto _ : state) {
+        doNotOptimize(p[i % INPUTS].normalized());
+        i++;
+    }
+}
+MICRO_BENCHMARK(BM_Vec3Normalized);
+
+static void BM_Vec3Cross(BenchState& state) {
+    std::vector<Vec3> p = randomVectors();
+    unsigned i = 0;
+    for ([[maybe_unused]] auto _ : state) {
+        doNotOptimize(p[i % INPUTS].cross(p[(i + 1) % INPUTS]));
+        i++;
+    }
+}
+MICRO_BENCHMARK(BM_Vec3Cross);
+
+static void BM_TextureSample(BenchState& state) {
+    Texture tex;
+    tex.width = tex.height = 256;
+    tex.channels = 3;
+    tex.data.resize(256 * 256 * 3);
+    for (size_t k = 0; k < tex.data.size(); k++) tex.data[k] = static_cast<unsigned char>(k * 31);
+    std::vector<Vec3> uv = randomVectors();  // x and y in [-1, 1] also exercise wrapping
+    unsigned i = 0;
+    for ([[maybe_unused]] auto _ : state) {
+        double r, g, b;
+        tex.sample(uv[i % INPUTS].x, uv[i % INPUTS].y, r, g, b);
+        doNotOptimize(r + g + b);
+        i++;
+    }
+}
+MICRO_BENCHMARK(BM_TextureSample);
+
+static void BM_InsideTriangle(BenchState& state) {
+    Renderer renderer(240, 60);
+    std::vector<Vec3> p = randomVectors();  // about half the points land inside
+    unsigned i = 0;
+    for ([[maybe_unused]] auto _ : state) {
+        double w0, w1, w2;
+        const Vec3& q = p[i % INPUTS];
+        doNotOptimize(renderer.insideTriangle(q.x, q.y, -1, -1, 1, -1, 0, 1, w0, w1, w2));
+        i++;
+    }
+}
+MICRO_BENCHMARK(BM_InsideTriangle);
+
+static void BM_IntensityToChar(BenchState& state) {
+    std::vector<Vec3> p = randomVectors();
+    unsigned i = 0;
+    for ([[maybe_unused]] auto _ : state) {
+        doNotOptimize(intensityToChar(p[i % INPUTS].x * 0.5 + 0.5)[0]);
+        i++;
+    }
+}
+MICRO_BENCHMARK(BM_IntensityToChar);
+
+// Loader checks. Meshes are compared bit for bit, so any difference in
+// parsing, index resolution or ordering shows up.
+
+template <typename T>
+static bool sameArray(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+static bool checkSameMesh(const std::string& name, const Mesh& a, const Mesh& b) {
+    const char* diff = !sameArray(a.vertices, b.vertices)       ? "vertices"
+                       : !sameArray(a.normals, b.normals)       ? "normals"
+                       : !sameArray(a.texCoords, b.texCoords)   ? "texture coordinates"
+                       : !sameArray(a.triangles, b.triangles)   ? "triangles"
+                       : !sameArray(a.texture.data, b.texture.data) || a.texture.width != b.texture.width ||
+                               a.texture.height != b.texture.height
+                           ? "texture"
+                           : nullptr;
+    if (diff)
+        std::printf("check %-48s differs in %s\n", name.c_str(), diff);
+    else
+        std::printf("check %-48s ok (%zu vertices, %zu triangles, %dx%d texture)\n", name.c_str(), a.vertices.size(),
+                    a.triangles.size(), a.texture.width, a.texture.height);
+    return !diff;
+}
+
+// Grid of rows x cols quads in every face syntax: relative and absolute
+// indices, v, v/t, v//n and v/t/n corners, pentagons, CRLF line ends,
+// comments, ignored records and a bare mtllib after the real one
+static std::string syntheticObj(int rows, int cols) {
+    std::string out = "# synthetic check mesh\nmtllib viewer_check.mtl\nmtllib\ng grid\nusemtl none\n";
+    char line[256];
+    const int stride = cols + 1;
+    for (int r = 0; r <= rows; r++) {
+        for (int c = 0; c <= cols; c++) {
+            std::snprintf(line, sizeof(line), "v %.17g %+.6f %.17g%s\n", c * 0.1, r * 0.1, std::sin(r * 0.3 + c * 0.2),
+                          c % 7 == 0 ? "\r" : "");
+            out += line;
+            std::snprintf(line, sizeof(line), "vt %.9g %.9g\n", c / static_cast<double>(cols), r / static_cast<double>(rows));
+            out += line;
+            std::snprintf(line, sizeof(line), "vn %.6f %.6f 1\n", std::cos(c * 0.2), std::sin(r * 0.3));
+            out += line;
+        }
+        if (r == 0) continue;
+        out += r % 5 == 0 ? "\n# row\ns off\n" : "";
+        // Elements of the previous row are -2 * stride .. -stride - 1 back
+        for (int c = 0; c < cols; c++) {
+            int a = -2 * stride + c, b = a + 1, d = -stride + c, e = d + 1;
+            int base = (r - 1) * stride + c + 1;  // absolute index of a
+            switch (c % 4) {
+            case 0: std::snprintf(line, sizeof(line), "f %d %d %d %d\n", a, b, e, d); break;
+            case 1: std::snprintf(line, sizeof(line), "f %d/%d %d/%d %d/%d %d/%d\n", a, a, b, b, e, e, d, d); break;
+            case 2: std::snprintf(line, sizeof(line), "f %d//%d %d//%d %d//%d\r\n", a, a, b, b, e, e); break;
+            default:
+                std::snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", base, base, base,
+                              base + 1, base + 1, base + 1, base + stride + 1, base + stride + 1, base + stride + 1,
+                              base + stride, base + stride, base + stride, base + stride - 1, base + stride - 1,
+                              base + stride - 1);
+            }
+            out += line;
+        }
+    }
+    return out;
+}
+
+static bool writeFile(const std::string& path, const std::string& text) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << text;
+    return out.good();
+}
+
+// Mesh::load against Mesh::loadStream on path
+static bool checkLoaders(const std::string& name, const std::string& path) {
+    Mesh reference, mapped;
+    if (!reference.loadStream(path) || !mapped.load(path)) {
+        std::printf("check %-48s cannot load %s\n", name.c_str(), path.c_str());
+        return false;
+    }
+    bool ok = checkSameMesh(name + " load vs loadStream", mapped, reference);
+
+    // Chunked loads cut the file at many more seams than a real run would
+    for (unsigned threads : {2u, 3u, 8u}) {
+        for (size_t chunkBytes : {size_t(1) << 10, size_t(1) << 14}) {
+            Mesh chunked;
+            chunked.load(path, threads, chunkBytes);
+            ok = checkSameMesh(name + " " + std::to_string(threads) + " threads, " + std::to_string(chunkBytes) +
+                                   " byte chunks vs 1 thread",
+                               chunked, mapped) &&
+                 ok;
+        }
+    }
+    return ok;
+}
+
+// The float vertex stage against a double transform, for a mesh far from
+// the origin where float coordinates alone would be off by ~0.06 units
+static bool checkFarVertices(double offset) {
+    Mesh mesh = makeSphere(40, 80);
+    for (Vec3& v : mesh.vertices) v = v + Vec3(offset, -offset, offset);
+    mesh.computeRenderData();
+    Renderer renderer(240, 60);
+    renderer.setClusterCulling(false);
+    renderer.viewProj = orbitViewProj(mesh, 0.3, 3.0);
+    renderer.render(mesh);
+
+    const std::vector<Vec4f>& clip = renderer.clipPositions();
+    double worst = 0;
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+        Vec3 expected = renderer.viewProj.transformPoint(mesh.vertices[i]);
+        const Vec4f& c = clip[i];
+        worst = std::max({worst, std::abs(c.x / c.w - expected.x), std::abs(c.y / c.w - expected.y)});
+    }
+    char name[64];
+    std::snprintf(name, sizeof(name), "float vertices at %.0e offset vs double", offset);
+    bool ok = worst < 1e-5;
+    std::printf("check %-48s %s (max NDC error %.1e)\n", name, ok ? "ok" : "MISMATCH", worst);
+    return ok;
+}
+
+static int runChecks() {
+    bool ok = checkLoaders("rose", VIEWER_EXAMPLE_DIR "/rose.obj");
+    ok = checkFarVertices(1e6) && ok;
+
+    // Written to the working directory; the material points at the example
+    // texture so mtllib handling is compared too
+    const std::string obj = "viewer_check.obj", mtl = "viewer_check.mtl";
+    if (writeFile(obj, syntheticObj(120, 40)) &&
+        writeFile(mtl, "newmtl grid\nmap_Kd " VIEWER_EXAMPLE_DIR "/Rose_Albedo.jpg\n")) {
+        ok = checkLoaders("synthetic", obj) && ok;
+    } else {
+        std::printf("check synthetic: cannot write %s\n", obj.c_str());
+        ok = false;
+    }
+    std::remove(obj.c_str());
+    std::remove(mtl.c_str());
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    std::string objPath = VIEWER_EXAMPLE_DIR "/rose.obj";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--check") return runChecks();
+        if (arg == "--micro" || arg.rfind("--micro=", 0) == 0) {
+            runMicroBenchmarks(arg.size() > 8 ? arg.substr(8) : std::string());
+            return 0;
+        }
+        objPath = arg;
+    }
+
+    runMicroBenchmarks("");
+
+    Mesh mesh;
+    if (mesh.load(objPath)) {
+        benchRaster(objPath.c_str(), mesh, 240, 60, 3.0);
+        benchRaster(objPath.c_str(), mesh, 400, 120, 3.0);
+        benchRaster(objPath.c_str(), mesh, 400, 120, 1.2);
+        benchEncode(objPath.c_str(), mesh, 240, 60);
+        benchEncode(objPath.c_str(), mesh, 400, 120);
+        benchEncode(objPath.c_str(), mesh, 240, 60, ColorMode::Xterm256, "256");
+        benchEncode(objPath.c_str(), mesh, 240, 60, ColorMode::Ansi16, "16");
+        benchEncode(objPath.c_str(), mesh, 240, 60, ColorMode::Mono, "mono");
+        benchLodBuild(objPath.c_str(), mesh, 240, 60);
+    } else {
+        std::fprintf(stderr, "Cannot load %s, skipping\n", objPath.c_str());
+    }
+
+    Mesh sphere = makeSphere(500, 1000);
+    unsigned hardwareThreads = std::thread::hardware_concurrency();
+    benchClusterBuild("sphere", sphere, 1);
+    if (hardwareThreads > 1) benchClusterBuild("sphere", sphere, hardwareThreads);
+    sphere.computeRenderData();
+    benchRaster("sphere", sphere, 240, 60, 3.0);
+    benchRaster("sphere", sphere, 400, 120, 3.0);
+    benchRaster("sphere", sphere, 240, 60, 1.2);
+    benchLodBuild("sphere", sphere, 240, 60);
+    LodChain sphereLods;
+    sphereLods.build(sphere);
+    size_t level = sphereLods.select(orbitViewProj(sphere, 0, 6.0), 240, 60);
+    benchRaster(("sphere lod " + std::to_string(level)).c_str(), sphereLods.level(level), 240, 60, 6.0);
+    return 0;
+}
@@ -0,0 +1,434 @@
+#pragma once
+
+#include "math.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Run of consecutive triangles close together in space, with their bounds
+// and the vertices they use: [firstVertex, vertexEnd) are the ones first
+// used by this cluster, the rest are listed in ClusterBvh::sharedVertices
+// [firstShared, sharedEnd)
+struct MeshCluster {
+    uint32_t firstTriangle, triangleEnd;
+    uint32_t firstVertex, vertexEnd;
+    uint32_t firstShared, sharedEnd;
+    Vec3 minV, maxV;  // model space
+    // Bounding sphere and a cone holding every face normal: the axis and
+    // the sine of its half-angle (1 when the normals spread too far to
+    // ever cull)
+    Vec3 center;
+    double radius;
+    Vec3 coneAxis;
+    double coneCutoff;
+};
+
+// Clusters (meshlets) of a mesh under an implicit bounding volume
+// hierarchy, for skipping geometry outside the view frustum or facing away
+// from the camera. build() reorders the mesh so that clusters are
+// contiguous runs of triangles, and the vertex ranges clusters own are
+// consecutive, disjoint and tight whatever else they share.
+class ClusterBvh {
+public:
+    static constexpr size_t CLUSTER_SIZE = 128;
+    // Meshes smaller than this are built on the calling thread
+    static constexpr size_t PARALLEL_MIN = 1 << 16;
+    static constexpr size_t BLOCK = 1 << 14;
+    static constexpr int RADIX_BITS = 10;
+
+    std::vector<MeshCluster> clusters;
+    // Vertices clusters use but an earlier cluster owns, ascending per
+    // cluster, and the cluster owning each
+    std::vector<uint32_t> sharedVertices, sharedOwners;
+
+    bool empty() const { return clusters.empty(); }
+
+    // Sort triangles along a Morton curve through their centroids and
+    // renumber vertices in order of first use, then cut the triangles into
+    // clusters of CLUSTER_SIZE. The order only depends on the geometry, so
+    // building again on the result changes nothing.
+    template <typename Tri>
+    void build(std::vector<Vec3>& vertices, std::vector<Tri>& triangles, unsigned threads = 1) {
+        TraceScope trace("cluster build");
+        clusters.clear();
+        sharedVertices.clear();
+        sharedOwners.clear();
+        nodes.clear();
+        const size_t count = triangles.size();
+        if (count == 0 || count > UINT32_MAX / 3 || vertices.size() > UINT32_MAX) return;
+
+        std::unique_ptr<ThreadPool> pool;
+        if (threads > 1 && count >= PARALLEL_MIN) pool.reset(new ThreadPool(threads));
+        auto forEach = [&](size_t n, const std::function<void(size_t)>& fn) {
+            if (pool) pool->parallelFor(n, fn);
+            else for (size_t i = 0; i < n; i++) fn(i);
+        };
+        const size_t blocks = (count + BLOCK - 1) / BLOCK;
+        auto blockEnd = [&](size_t b) { return std::min(count, (b + 1) * BLOCK); };
+        auto centroid = [&](const Tri& t) { return (vertices[t.v0] + vertices[t.v1] + vertices[t.v2]) * (1.0 / 3); };
+
+        // Centroid bounds, then a key of Morton code and original index
+        std::vector<Vec3> blockMin(blocks), blockMax(blocks);
+        forEach(blocks, [&](size_t b) {
+            Vec3 lo(1e300, 1e300, 1e300), hi(-1e300, -1e300, -1e300);
+            for (size_t i = b * BLOCK; i < blockEnd(b); i++) grow(lo, hi, centroid(triangles[i]));
+            blockMin[b] = lo;
+            blockMax[b] = hi;
+        });
+        Vec3 lo = blockMin[0], hi = blockMax[0];
+        for (size_t b = 1; b < blocks; b++) {
+            grow(lo, hi, blockMin[b]);
+            grow(lo, hi, blockMax[b]);
+        }
+        Vec3 extent = hi - lo;
+        Vec3 toGrid(extent.x > 0 ? 1023.0 / extent.x : 0, extent.y > 0 ? 1023.0 / extent.y : 0,
+                    extent.z > 0 ? 1023.0 / extent.z : 0);
+
+        std::vector<uint64_t> keys(count), scratch(count);
+        forEach(blocks, [&](size_t b) {
+            for (size_t i = b * BLOCK; i < blockEnd(b); i++) {
+                Vec3 c = centroid(triangles[i]) - lo;
+                uint64_t code = morton(static_cast<uint32_t>(c.x * toGrid.x), static_cast<uint32_t>(c.y * toGrid.y),
+                                       static_cast<uint32_t>(c.z * toGrid.z));
+                keys[i] = code << 32 | i;
+            }
+        });
+        // Stable LSD radix sort on the 30 code bits, RADIX_BITS at a time:
+        // per-block digit counts, their prefix sums over (digit, block), then
+        // every block scatters its keys to their final slots
+        std::vector<size_t> offsets(blocks << RADIX_BITS);
+        for (int shift = 32; shift < 62; shift += RADIX_BITS) {
+            auto digit = [&](uint64_t key) { return (key >> shift) & ((1u << RADIX_BITS) - 1); };
+            forEach(blocks, [&](size_t b) {
+                size_t* count = &offsets[b << RADIX_BITS];
+                std::fill(count, count + (1 << RADIX_BITS), 0);
+                for (size_t i = b * BLOCK; i < blockEnd(b); i++) count[digit(keys[i])]++;
+            });
+            size_t sum = 0;
+            for (size_t d = 0; d < (1u << RADIX_BITS); d++) {
+                for (size_t b = 0; b < blocks; b++) {
+                    size_t n = offsets[(b << RADIX_BITS) + d];
+                    offsets[(b << RADIX_BITS) + d] = sum;
+                    sum += n;
+                }
+            }
+            forEach(blocks, [&](size_t b) {
+                size_t* slot = &offsets[b << RADIX_BITS];
+                for (size_t i = b * BLOCK; i < blockEnd(b); i++) scratch[slot[digit(keys[i])]++] = keys[i];
+            });
+            keys.swap(scratch);
+        }
+
+        std::vector<Tri> sorted(count);
+        forEach(blocks, [&](size_t b) {
+            for (size_t i = b * BLOCK; i < blockEnd(b); i++) sorted[i] = triangles[keys[i] & 0xffffffffu];
+        });
+        triangles.swap(sorted);
+
+        // Vertices in order of first use, so each cluster owns the run of
+        // vertices it uses first; unused ones go last
+        clusters.resize((count + CLUSTER_SIZE - 1) / CLUSTER_SIZE);
+        std::vector<int> remap(vertices.size(), -1);
+        int next = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (i % CLUSTER_SIZE == 0) {
+                clusters[i / CLUSTER_SIZE].firstVertex = static_cast<uint32_t>(next);
+                if (i > 0) clusters[i / CLUSTER_SIZE - 1].vertexEnd = static_cast<uint32_t>(next);
+            }
+            Tri& t = triangles[i];
+            int* corner[3] = {&t.v0, &t.v1, &t.v2};
+            for (int* v : corner) {
+                int& r = remap[*v];
+                if (r < 0) r = next++;
+                *v = r;
+            }
+        }
+        clusters.back().vertexEnd = static_cast<uint32_t>(next);
+        for (int& r : remap)
+            if (r < 0) r = next++;
+        std::vector<Vec3> reordered(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) reordered[remap[i]] = vertices[i];
+        vertices.swap(reordered);
+
+        std::vector<std::vector<uint32_t>> shared(clusters.size());
+        forEach((clusters.size() + 63) / 64, [&](size_t b) {
+            for (size_t c = b * 64; c < std::min(clusters.size(), (b + 1) * 64); c++) {
+                MeshCluster& cl = clusters[c];
+                cl.firstTriangle = static_cast<uint32_t>(c * CLUSTER_SIZE);
+                cl.triangleEnd = static_cast<uint32_t>(std::min(count, (c + 1) * CLUSTER_SIZE));
+                cl.minV = Vec3(1e300, 1e300, 1e300);
+                cl.maxV = Vec3(-1e300, -1e300, -1e300);
+                for (uint32_t i = cl.firstTriangle; i < cl.triangleEnd; i++) {
+                    const Tri& t = triangles[i];
+                    for (int v : {t.v0, t.v1, t.v2}) {
+                        grow(cl.minV, cl.maxV, vertices[v]);
+                        if (static_cast<uint32_t>(v) < cl.firstVertex) shared[c].push_back(static_cast<uint32_t>(v));
+                    }
+                }
+                std::sort(shared[c].begin(), shared[c].end());
+                shared[c].erase(std::unique(shared[c].begin(), shared[c].end()), shared[c].end());
+                cl.center = (cl.minV + cl.maxV) * 0.5;
+                cl.radius = (cl.maxV - cl.minV).length() * 0.5;
+                normalCone(vertices, triangles, cl);
+            }
+        });
+        for (size_t c = 0; c < clusters.size(); c++) {
+            clusters[c].firstShared = static_cast<uint32_t>(sharedVertices.size());
+            for (uint32_t v : shared[c]) {
+                // Owned ranges are consecutive, so the owner is the first
+                // cluster ending past v
+                auto owner = std::upper_bound(clusters.begin(), clusters.begin() + c, v,
+                                              [](uint32_t x, const MeshCluster& cl) { return x < cl.vertexEnd; });
+                sharedVertices.push_back(v);
+                sharedOwners.push_back(static_cast<uint32_t>(owner - clusters.begin()));
+            }
+            clusters[c].sharedEnd = static_cast<uint32_t>(sharedVertices.size());
+        }
+
+        buildTree();
+    }
+
+    // Adopt the result of an earlier build() of these triangles, as stored
+    // by MeshCache, after checking that it describes them the way build()
+    // would: contiguous cluster runs covering every triangle, consecutive
+    // owned vertex ranges, and every corner either owned by its cluster or
+    // in its ascending shared list. Leaves the hierarchy empty and returns
+    // false otherwise.
+    template <typename Tri>
+    bool assign(std::vector<MeshCluster> stored, std::vector<uint32_t> shared, std::vector<uint32_t> owners,
+                const std::vector<Tri>& triangles, size_t vertexCount) {
+        clusters.clear();
+        sharedVertices.clear();
+        sharedOwners.clear();
+        nodes.clear();
+        if (stored.empty()) return triangles.empty() || triangles.size() > UINT32_MAX / 3;
+        if (owners.size() != shared.size()) return false;
+        uint32_t triangle = 0, vertex = 0, sharedIndex = 0;
+        for (size_t c = 0; c < stored.size(); c++) {
+            const MeshCluster& cl = stored[c];
+            if (cl.firstTriangle != triangle || cl.triangleEnd <= triangle || cl.triangleEnd > triangles.size() ||
+                cl.firstVertex != vertex || cl.vertexEnd < vertex || cl.vertexEnd > vertexCount ||
+                cl.firstShared != sharedIndex || cl.sharedEnd < sharedIndex || cl.sharedEnd > shared.size())
+                return false;
+            const uint32_t* sharedBegin = shared.data() + cl.firstShared;
+            const uint32_t* sharedEnd = shared.data() + cl.sharedEnd;
+            for (uint32_t k = cl.firstShared; k < cl.sharedEnd; k++) {
+                uint32_t v = shared[k], owner = owners[k];
+                if ((k > cl.firstShared && shared[k - 1] >= v) || owner >= c || v < stored[owner].firstVertex ||
+                    v >= stored[owner].vertexEnd)
+                    return false;
+            }
+            for (uint32_t i = cl.firstTriangle; i < cl.triangleEnd; i++) {
+                const Tri& t = triangles[i];
+                for (int v : {t.v0, t.v1, t.v2}) {
+                    uint32_t u = static_cast<uint32_t>(v);
+                    if (v < 0 || u >= cl.vertexEnd ||
+                        (u < cl.firstVertex && !std::binary_search(sharedBegin, sharedEnd, u)))
+                        return false;
+                }
+            }
+            triangle = cl.triangleEnd;
+            vertex = cl.vertexEnd;
+            sharedIndex = cl.sharedEnd;
+        }
+        if (triangle != triangles.size() || sharedIndex != shared.size()) return false;
+        clusters = std::move(stored);
+        sharedVertices = std::move(shared);
+        sharedOwners = std::move(owners);
+        buildTree();
+        return true;
+    }
+
+    // Calls visit(first, end) with ascending, disjoint ranges of clusters
+    // that may intersect the frustum of viewProj (near plane and sides; the
+    // far plane is not used for culling) and may have a triangle facing the
+    // camera. Clusters left out are entirely outside one of those planes or
+    // only hold back faces.
+    template <typename Visit>
+    void cull(const Mat4& viewProj, Visit&& visit) const {
+        if (nodes.empty()) return;
+
+        // Camera position in model space: the point viewProj maps to
+        // x = y = w = 0. A triangle with normal n through p projects
+        // counter-clockwise (front-facing) exactly when
+        // eye.w * dot(n, eyePos - p) > 0, whatever the matrix.
+        const Vec4 eye = nullPoint(viewProj);
+        const bool cones = std::abs(eye.w) > 1e-300;
+        const Vec3 eyePos = cones ? Vec3(eye.x / eye.w, eye.y / eye.w, eye.z / eye.w) : Vec3();
+        const double side = eye.w > 0 ? 1 : -1;
+        auto backFacing = [&](const MeshCluster& cl) {
+            if (cl.coneCutoff >= 1) return false;
+            Vec3 view = cl.center - eyePos;
+            double distance = view.length();
+            return side * view.dot(cl.coneAxis) > cl.coneCutoff * distance + cl.radius + CONE_SLACK * distance;
+        };
+        // Visit the front-facing runs of [first, end)
+        auto visitFacing = [&](uint32_t first, uint32_t end) {
+            if (!cones) {
+                visit(first, end);
+                return;
+            }
+            uint32_t run = first;
+            for (uint32_t c = first; c < end; c++) {
+                if (!backFacing(clusters[c])) continue;
+                if (run < c) visit(run, c);
+                run = c + 1;
+            }
+            if (run < end) visit(run, end);
+        };
+
+        const size_t leafStart = nodes.size() / 2;
+        uint32_t stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if (node.first >= node.end) continue;
+            Vec3 corners[8];
+            for (int k = 0; k < 8; k++)
+                corners[k] = Vec3(k & 1 ? node.maxV.x : node.minV.x, k & 2 ? node.maxV.y : node.minV.y,
+                                  k & 4 ? node.maxV.z : node.minV.z);
+            Vec4 clip[8];
+            viewProj.transformPoints(corners, clip, 8);
+            unsigned outsideAll = ~0u, outsideAny = 0;
+            for (const Vec4& c : clip) {
+                unsigned code = outcode(c);
+                outsideAll &= code;
+                outsideAny |= code;
+            }
+            if (outsideAll) continue;
+            uint32_t index = static_cast<uint32_t>(&node - nodes.data());
+            if (!outsideAny || index >= leafStart) {
+                visitFacing(node.first, node.end);
+                continue;
+            }
+            stack[top++] = 2 * index + 2;
+            stack[top++] = 2 * index + 1;
+        }
+    }
+
+private:
+    // Complete binary tree in heap order: node i has children 2i+1 and
+    // 2i+2, covers clusters [first, end) and is empty when first == end
+    struct Node {
+        Vec3 minV, maxV;
+        uint32_t first, end;
+    };
+    std::vector<Node> nodes;
+
+    // Extra margin of the back-face test, relative to the distance, so that
+    // nearly edge-on triangles are never culled on rounding
+    static constexpr double CONE_SLACK = 1e-3;
+
+    // Bounds of every node over the clusters, bottom up
+    void buildTree() {
+        // Leaves are the clusters, padded with empty nodes to a power of two
+        size_t leaves = 1;
+        while (leaves < clusters.size()) leaves *= 2;
+        const uint32_t n = static_cast<uint32_t>(clusters.size());
+        nodes.resize(2 * leaves - 1);
+        for (size_t k = 0; k < leaves; k++) {
+            Node& node = nodes[leaves - 1 + k];
+            if (k < n) {
+                node.minV = clusters[k].minV;
+                node.maxV = clusters[k].maxV;
+                node.first = static_cast<uint32_t>(k);
+                node.end = static_cast<uint32_t>(k + 1);
+            } else {
+                node.first = node.end = n;
+            }
+        }
+        for (size_t i = leaves - 1; i-- > 0;) {
+            Node& node = nodes[i];
+            const Node& left = nodes[2 * i + 1];
+            const Node& right = nodes[2 * i + 2];
+            node.first = left.first;
+            node.end = std::max(left.end, right.end);
+            node.minV = left.minV;
+            node.maxV = left.maxV;
+            if (right.first < right.end) {
+                grow(node.minV, node.maxV, right.minV);
+                grow(node.minV, node.maxV, right.maxV);
+            }
+        }
+    }
+
+    // Axis and cutoff of the normal cone of cl's triangles. Triangles with
+    // two coincident vertices project to zero area and are left out; any
+    // other degenerate one disables culling.
+    template <typename Tri>
+    static void normalCone(const std::vector<Vec3>& vertices, const std::vector<Tri>& triangles, MeshCluster& cl) {
+        cl.coneAxis = Vec3();
+        cl.coneCutoff = 1;
+        Vec3 normals[CLUSTER_SIZE], sum;
+        size_t count = 0;
+        for (uint32_t i = cl.firstTriangle; i < cl.triangleEnd; i++) {
+            const Tri& t = triangles[i];
+            const Vec3 &p0 = vertices[t.v0], &p1 = vertices[t.v1], &p2 = vertices[t.v2];
+            Vec3 n = (p1 - p0).cross(p2 - p0).normalized();
+            if (n.length() == 0) {
+                if (samePoint(p0, p1) || samePoint(p1, p2) || samePoint(p2, p0)) continue;
+                return;
+            }
+            normals[count++] = n;
+            sum = sum + n;
+        }
+        Vec3 axis = sum.normalized();
+        if (axis.length() == 0) return;
+        double minDot = 1;
+        for (size_t i = 0; i < count; i++) minDot = std::min(minDot, normals[i].dot(axis));
+        cl.coneAxis = axis;
+        if (minDot > 0) cl.coneCutoff = std::sqrt(1 - minDot * minDot);
+    }
+
+    static bool samePoint(const Vec3& a, const Vec3& b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+
+    // Homogeneous point orthogonal to rows x, y and w of m (their 4D cross
+    // product), i.e. the centre of projection
+    static Vec4 nullPoint(const Mat4& m) {
+        auto det3 = [](double a0, double a1, double a2, double b0, double b1, double b2, double c0, double c1,
+                       double c2) { return a0 * (b1 * c2 - b2 * c1) - a1 * (b0 * c2 - b2 * c0) + a2 * (b0 * c1 - b1 * c0); };
+        const double* a = m.m;  // row x is m[0], m[4], m[8], m[12]; y and w likewise
+        auto r = [&](int row, int col) { return a[col * 4 + row]; };
+        return Vec4(det3(r(0, 1), r(0, 2), r(0, 3), r(1, 1), r(1, 2), r(1, 3), r(3, 1), r(3, 2), r(3, 3)),
+                    -det3(r(0, 0), r(0, 2), r(0, 3), r(1, 0), r(1, 2), r(1, 3), r(3, 0), r(3, 2), r(3, 3)),
+                    det3(r(0, 0), r(0, 1), r(0, 3), r(1, 0), r(1, 1), r(1, 3), r(3, 0), r(3, 1), r(3, 3)),
+                    -det3(r(0, 0), r(0, 1), r(0, 2), r(1, 0), r(1, 1), r(1, 2), r(3, 0), r(3, 1), r(3, 2)));
+    }
+
+    static void grow(Vec3& lo, Vec3& hi, const Vec3& p) {
+        lo = Vec3(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+        hi = Vec3(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+    }
+
+    // Interleave the low 10 bits of x, y and z
+    static uint64_t morton(uint32_t x, uint32_t y, uint32_t z) {
+        auto spread = [](uint64_t v) {
+            v &= 0x3ff;
+            v = (v | v << 16) & 0x30000ff;
+            v = (v | v << 8) & 0x300f00f;
+            v = (v | v << 4) & 0x30c30c3;
+            v = (v | v << 2) & 0x9249249;
+            return v;
+        };
+        return spread(x) | spread(y) << 1 | spread(z) << 2;
+    }
+
+    // Frustum planes a clip-space point lies outside of, with a little slack
+    // so rounding never culls geometry the rasterizer would have drawn
+    static unsigned outcode(const Vec4& c) {
+        const double slack = 1e-6 * (std::abs(c.x) + std::abs(c.y) + std::abs(c.z) + std::abs(c.w));
+        unsigned code = 0;
+        if (c.x + c.w < -slack) code |= 1;
+        if (c.w - c.x < -slack) code |= 2;
+        if (c.y + c.w < -slack) code |= 4;
+        if (c.w - c.y < -slack) code |= 8;
+        if (c.z + c.w < -slack) code |= 16;
+        return code;
+    }
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+
+// Single-producer, single-consumer handoff that only keeps the newest value
+// (a triple buffer). The producer fills writeSlot() and publishes it; the
+// consumer takes the most recent publication and older unread ones are
+// dropped. Each side owns one slot and the third sits in between, so neither
+// ever waits for the other to finish with a buffer, and slot storage is
+// reused from value to value.
+template <typename T>
+class LatestValue {
+public:
+    T& writeSlot() { return slots[writeIdx]; }
+
+    void publish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(writeIdx, midIdx);
+            if (fresh) dropped++;
+            fresh = true;
+        }
+        cv.notify_one();
+    }
+
+    // Block until a value newer than the last one taken is available.
+    // Returns nullptr once closed and drained.
+    T* waitLatest() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return fresh || closed; });
+        if (!fresh) return nullptr;
+        std::swap(readIdx, midIdx);
+        fresh = false;
+        return &slots[readIdx];
+    }
+
+    // Wake the consumer for good; a value published before close is still delivered
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        cv.notify_one();
+    }
+
+    // Publications overwritten before the consumer saw them
+    size_t droppedCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return dropped;
+    }
+
+private:
+    T slots[3];
+    int writeIdx = 0, midIdx = 1, readIdx = 2;
+    bool fresh = false, closed = false;
+    size_t dropped = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
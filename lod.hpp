@@ -0,0 +1,416 @@
+#pragma once
+
+#include "math.hpp"
+#include "obj_parser.hpp"
+#include "texture.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// Coarser copies of a mesh for views where its triangles shrink below a
+// pixel. Level 0 is the mesh itself; each further level has about RATIO
+// times the triangles of the one before, made by quadric error metric edge
+// collapse (Garland & Heckbert), and records an estimate of how far its
+// surface strays from the original in model units. The estimate is the root
+// of the largest quadric error of any collapse, an area-weighted mean over
+// the planes around the collapsed vertex rather than a maximum, so it is a
+// heuristic and not a bound. A level stops short of its triangle target
+// rather than take collapses well above the going cost, and ends the chain
+// there, so the coarsest level is still a usable approximation. The chain
+// refers to the mesh it was built from, which must outlive it.
+class LodChain {
+public:
+    static constexpr size_t MAX_LEVELS = 5;  // including the mesh itself
+    static constexpr double RATIO = 0.25;
+    // No level is made below this many triangles
+    static constexpr size_t MIN_TRIANGLES = 2048;
+    // Default screen-space error select() allows, in pixels
+    static constexpr double PIXEL_ERROR = 0.5;
+
+    // Simplify mesh into up to maxLevels - 1 coarser levels, each built
+    // from the one before and given render data for threads threads.
+    // Vertices on UV seams or open borders never move, so texture
+    // coordinates stay exact; vertex normals are dropped, as the renderer
+    // shades with face normals.
+    void build(const Mesh& mesh, unsigned threads = 1, size_t maxLevels = MAX_LEVELS) {
+        TraceScope trace("lod build");
+        base = &mesh;
+        coarse.clear();
+        mesh.bounds(boundsMin, boundsMax);
+        if (mesh.triangles.size() * RATIO < MIN_TRIANGLES || maxLevels < 2) return;
+
+        Simplifier s(mesh);
+        size_t target = mesh.triangles.size();
+        while (coarse.size() + 1 < maxLevels) {
+            target = static_cast<size_t>(target * RATIO);
+            if (target < MIN_TRIANGLES) break;
+            size_t before = s.triangleCount();
+            bool reached = s.simplify(target);
+            // Stop once seams and borders leave too little to remove
+            if (s.triangleCount() > before - (before - target) / 2) break;
+            coarse.push_back({s.toMesh(threads), std::sqrt(s.maxError)});
+            target = s.triangleCount();
+            // A level cut short by costly collapses is the last
+            if (!reached) break;
+        }
+    }
+
+    // Coarse levels as stored by MeshCache: level i + 1 and its error
+    struct Level {
+        Mesh mesh;
+        double error;
+    };
+
+    // Take levels from a cache instead of building them
+    void restore(const Mesh& mesh, std::vector<Level> levels) {
+        base = &mesh;
+        coarse = std::move(levels);
+        mesh.bounds(boundsMin, boundsMax);
+    }
+
+    // Whether build or restore has run
+    bool ready() const { return base != nullptr; }
+    const std::vector<Level>& coarseLevels() const { return coarse; }
+
+    size_t levels() const { return 1 + coarse.size(); }
+    const Mesh& level(size_t i) const { return i == 0 ? *base : coarse[i - 1].mesh; }
+    // Estimated model-space distance of level i from the original surface
+    double error(size_t i) const { return i == 0 ? 0 : coarse[i - 1].error; }
+    // Coarse levels have no texture of their own
+    const Texture& texture() const { return base->texture; }
+
+    // Coarsest level whose estimated error, projected at the point of the
+    // mesh's bounding sphere nearest the camera, stays within pixelError
+    // pixels on a width x height target. Level 0 when the camera is inside
+    // the sphere. As error() is not a bound, neither is pixelError.
+    size_t select(const Mat4& viewProj, int width, int height, double pixelError = PIXEL_ERROR) const {
+        const double* m = viewProj.m;
+        auto rowLength = [&](int r) { return Vec3(m[r], m[4 + r], m[8 + r]).length(); };
+        Vec3 center = (boundsMin + boundsMax) * 0.5;
+        double radius = (boundsMax - boundsMin).length() * 0.5;
+        double w = m[3] * center.x + m[7] * center.y + m[11] * center.z + m[15] - radius * rowLength(3);
+        if (!(w > 1e-9)) return 0;
+        // Bound on how far a model-space step of 1 moves a point on screen,
+        // for points inside the view: d(x/w) <= (|dx| + |x/w| |dw|) / w
+        double perUnit = std::max((rowLength(0) + rowLength(3)) * width, (rowLength(1) + rowLength(3)) * height) *
+                         0.5 / w;
+        size_t chosen = 0;
+        while (chosen + 1 < levels() && error(chosen + 1) * perUnit <= pixelError) chosen++;
+        return chosen;
+    }
+
+private:
+    const Mesh* base = nullptr;
+    std::vector<Level> coarse;
+    Vec3 boundsMin, boundsMax;
+
+    // Area-weighted sum of squared distances to planes; divided by the
+    // total weight it gives a mean squared distance
+    struct Quadric {
+        double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+        double b0 = 0, b1 = 0, b2 = 0, c = 0, w = 0;
+
+        // Plane n.p + d = 0 with unit normal n
+        static Quadric plane(const Vec3& n, double d, double weight) {
+            Quadric q;
+            q.a00 = n.x * n.x * weight; q.a11 = n.y * n.y * weight; q.a22 = n.z * n.z * weight;
+            q.a01 = n.x * n.y * weight; q.a02 = n.x * n.z * weight; q.a12 = n.y * n.z * weight;
+            q.b0 = n.x * d * weight; q.b1 = n.y * d * weight; q.b2 = n.z * d * weight;
+            q.c = d * d * weight;
+            q.w = weight;
+            return q;
+        }
+
+        void add(const Quadric& q) {
+            a00 += q.a00; a11 += q.a11; a22 += q.a22; a01 += q.a01; a02 += q.a02; a12 += q.a12;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; w += q.w;
+        }
+
+        // Mean squared distance of p from the planes of this and o together
+        double error(const Quadric& o, const Vec3& p) const {
+            double sum = (a00 + o.a00) * p.x * p.x + (a11 + o.a11) * p.y * p.y + (a22 + o.a22) * p.z * p.z +
+                         2 * ((a01 + o.a01) * p.x * p.y + (a02 + o.a02) * p.x * p.z + (a12 + o.a12) * p.y * p.z) +
+                         2 * ((b0 + o.b0) * p.x + (b1 + o.b1) * p.y + (b2 + o.b2) * p.z) + c + o.c;
+            double weight = w + o.w;
+            return weight > 0 ? std::max(0.0, sum / weight) : 0;
+        }
+    };
+
+    // Half-edge collapse simplifier: a vertex only ever moves onto a
+    // neighbour, so positions and texture coordinates are always original
+    // ones. Works in passes over a snapshot of the adjacency; a vertex is
+    // moved or moved onto at most once per pass, which keeps the triangle
+    // lists of all untouched vertices exact.
+    class Simplifier {
+    public:
+        double maxError = 0;  // largest quadric error (mean squared distance) of any collapse so far
+
+        explicit Simplifier(const Mesh& mesh)
+            : positions(mesh.vertices), texCoords(mesh.texCoords), quadrics(mesh.vertices.size()),
+              locked(mesh.vertices.size(), 0) {
+            const size_t vertexCount = positions.size();
+            indices.reserve(mesh.triangles.size() * 3);
+            corners.reserve(mesh.triangles.size() * 3);
+            for (const Triangle& t : mesh.triangles) {
+                uint32_t v[3] = {static_cast<uint32_t>(t.v0), static_cast<uint32_t>(t.v1),
+                                 static_cast<uint32_t>(t.v2)};
+                if (v[0] >= vertexCount || v[1] >= vertexCount || v[2] >= vertexCount) continue;
+                indices.insert(indices.end(), v, v + 3);
+                corners.push_back(t.t0);
+                corners.push_back(t.t1);
+                corners.push_back(t.t2);
+            }
+
+            for (size_t t = 0; t < indices.size(); t += 3) {
+                const Vec3 &p0 = positions[indices[t]], &p1 = positions[indices[t + 1]],
+                           &p2 = positions[indices[t + 2]];
+                Vec3 n = (p1 - p0).cross(p2 - p0);
+                double area = n.length() * 0.5;
+                if (area <= 0) continue;
+                n = n / (area * 2);
+                Quadric q = Quadric::plane(n, -n.dot(p0), area);
+                for (int k = 0; k < 3; k++) quadrics[indices[t + k]].add(q);
+            }
+
+            // Lock seams (corners with different texture coordinates) and
+            // vertices whose fan is not a single closed loop
+            buildAdjacency();
+            std::vector<int> firstCorner(vertexCount, INT32_MIN);
+            for (size_t c = 0; c < indices.size(); c++) {
+                int& seen = firstCorner[indices[c]];
+                if (seen == INT32_MIN) seen = corners[c];
+                else if (seen != corners[c]) locked[indices[c]] = 1;
+            }
+            std::vector<uint32_t> next, prev;
+            for (uint32_t v = 0; v < vertexCount; v++) {
+                if (locked[v]) continue;
+                next.clear();
+                prev.clear();
+                for (uint32_t i = fanOffset[v]; i < fanOffset[v + 1]; i++) {
+                    uint32_t t = fans[i] * 3;
+                    int k = corner(t, v);
+                    next.push_back(indices[t + (k + 1) % 3]);
+                    prev.push_back(indices[t + (k + 2) % 3]);
+                }
+                std::sort(next.begin(), next.end());
+                std::sort(prev.begin(), prev.end());
+                if (next != prev || std::adjacent_find(next.begin(), next.end()) != next.end() ||
+                    std::binary_search(next.begin(), next.end(), v))
+                    locked[v] = 1;
+            }
+        }
+
+        size_t triangleCount() const { return indices.size() / 3; }
+
+        // Collapse edges until at most target triangles are left or no edge
+        // can go cheaply enough; returns whether the target was reached
+        bool simplify(size_t target) {
+            TraceScope trace("simplify");
+            std::vector<uint8_t> touched;
+            while (triangleCount() > target) {
+                buildAdjacency();
+                collectCandidates();
+                if (candidates.empty()) return false;
+
+                // Try collapses up to half again the cost of the one that
+                // would reach the target if none were blocked, cheapest
+                // first, leaving the rest to later passes. When none of
+                // those can go, what is left costs far more than the mesh
+                // has paid so far, so stop short of the target instead.
+                size_t goal = triangleCount() - target, removed = 0;
+                size_t goalIndex = std::min(candidates.size() - 1, goal / 2);
+                std::nth_element(candidates.begin(), candidates.begin() + goalIndex, candidates.end());
+                double limit = candidates[goalIndex].cost * 1.5;
+                auto last = std::partition(candidates.begin(), candidates.end(),
+                                           [&](const Candidate& c) { return c.cost <= limit; });
+                std::sort(candidates.begin(), last);
+                touched.assign(positions.size(), 0);
+                for (auto c = candidates.begin(); c != last && removed < goal; ++c) {
+                    if (touched[c->from] || touched[c->to]) continue;
+                    int tex = -1;
+                    if (!collapsible(c->from, c->to, tex)) continue;
+                    removed += collapse(c->from, c->to, tex);
+                    touched[c->from] = touched[c->to] = 1;
+                    maxError = std::max(maxError, c->cost);
+                }
+                if (removed == 0) return false;
+                compact();
+            }
+            return true;
+        }
+
+        // The current triangles as a mesh with render data, keeping only the
+        // vertices and texture coordinates they use
+        Mesh toMesh(unsigned threads) const {
+            Mesh mesh;
+            std::vector<int> vertexMap(positions.size(), -1), texMap(texCoords.size(), -1);
+            auto mapIndex = [](std::vector<int>& map, int i, size_t& count) {
+                if (map[i] < 0) map[i] = static_cast<int>(count++);
+                return map[i];
+            };
+            size_t vertexCount = 0, texCount = 0;
+            mesh.triangles.resize(triangleCount());
+            for (size_t t = 0; t < triangleCount(); t++) {
+                Triangle& tri = mesh.triangles[t];
+                int* v[3] = {&tri.v0, &tri.v1, &tri.v2};
+                int* tc[3] = {&tri.t0, &tri.t1, &tri.t2};
+                for (int k = 0; k < 3; k++) {
+                    *v[k] = mapIndex(vertexMap, indices[t * 3 + k], vertexCount);
+                    int c = corners[t * 3 + k];
+                    *tc[k] = c >= 0 && static_cast<size_t>(c) < texCoords.size() ? mapIndex(texMap, c, texCount) : -1;
+                }
+            }
+            mesh.vertices.resize(vertexCount);
+            for (size_t i = 0; i < positions.size(); i++)
+                if (vertexMap[i] >= 0) mesh.vertices[vertexMap[i]] = positions[i];
+            mesh.texCoords.resize(texCount);
+            for (size_t i = 0; i < texCoords.size(); i++)
+                if (texMap[i] >= 0) mesh.texCoords[texMap[i]] = texCoords[i];
+            mesh.computeRenderData(threads);
+            return mesh;
+        }
+
+    private:
+        struct Candidate {
+            double cost;
+            uint32_t from, to;
+            bool operator<(const Candidate& o) const {
+                if (cost != o.cost) return cost < o.cost;
+                return from != o.from ? from < o.from : to < o.to;
+            }
+        };
+
+        const std::vector<Vec3>& positions;
+        const std::vector<Vec2>& texCoords;
+        std::vector<uint32_t> indices;  // three per live triangle
+        std::vector<int> corners;       // texture coordinate index per corner
+        std::vector<Quadric> quadrics;
+        std::vector<uint8_t> locked;
+        // Triangles around each vertex: fans[fanOffset[v] .. fanOffset[v + 1])
+        std::vector<uint32_t> fanOffset, fans;
+        std::vector<Candidate> candidates;
+        // Scratch for collapsible
+        std::vector<uint32_t> opposite, fromRing, toRing, common;
+
+        int corner(uint32_t t, uint32_t v) const { return indices[t] == v ? 0 : indices[t + 1] == v ? 1 : 2; }
+
+        void buildAdjacency() {
+            fanOffset.assign(positions.size() + 1, 0);
+            for (uint32_t v : indices) fanOffset[v + 1]++;
+            for (size_t v = 0; v < positions.size(); v++) fanOffset[v + 1] += fanOffset[v];
+            fans.resize(indices.size());
+            std::vector<uint32_t> fill(fanOffset.begin(), fanOffset.end() - 1);
+            for (size_t c = 0; c < indices.size(); c++) fans[fill[indices[c]]++] = static_cast<uint32_t>(c / 3);
+        }
+
+        // Cheaper direction of every edge with a movable end; each interior
+        // edge is seen from its two triangles, once as a < b
+        void collectCandidates() {
+            candidates.clear();
+            for (size_t t = 0; t < indices.size(); t += 3) {
+                for (int k = 0; k < 3; k++) {
+                    uint32_t a = indices[t + k], b = indices[t + (k + 1) % 3];
+                    if (a >= b || (locked[a] && locked[b])) continue;
+                    const Vec3 &pa = positions[a], &pb = positions[b];
+                    double toB = locked[a] ? INFINITY : quadrics[a].error(quadrics[b], pb);
+                    double toA = locked[b] ? INFINITY : quadrics[a].error(quadrics[b], pa);
+                    if (toB <= toA) candidates.push_back({toB, a, b});
+                    else candidates.push_back({toA, b, a});
+                }
+            }
+        }
+
+        // Whether moving from onto to keeps the surface a manifold (the
+        // link condition: the only vertices next to both ends are the
+        // opposite corners of the triangles on the edge) and every
+        // surviving triangle facing the same way; tex receives the texture
+        // coordinate the moved corners take over from to
+        bool collapsible(uint32_t from, uint32_t to, int& tex) {
+            const double MIN_COS = 0.25;
+            bool shared = false;
+            const Vec3& target = positions[to];
+            opposite.clear();
+            fromRing.clear();
+            for (uint32_t i = fanOffset[from]; i < fanOffset[from + 1]; i++) {
+                uint32_t t = fans[i] * 3;
+                if (indices[t] == DEAD) continue;
+                int k = corner(t, from);
+                uint32_t b = indices[t + (k + 1) % 3], c = indices[t + (k + 2) % 3];
+                fromRing.push_back(b);
+                fromRing.push_back(c);
+                if (b == to || c == to) {
+                    int ct = corners[t + (b == to ? (k + 1) % 3 : (k + 2) % 3)];
+                    if (shared && ct != tex) return false;
+                    tex = ct;
+                    shared = true;
+                    opposite.push_back(b == to ? c : b);
+                    continue;
+                }
+                const Vec3 &pb = positions[b], &pc = positions[c];
+                Vec3 before = (pb - positions[from]).cross(pc - positions[from]);
+                Vec3 after = (pb - target).cross(pc - target);
+                if (before.dot(after) <= MIN_COS * before.length() * after.length()) return false;
+            }
+            if (!shared) return false;
+
+            // Triangle lists of untouched vertices are exact, so to's ring
+            // is current
+            toRing.clear();
+            for (uint32_t i = fanOffset[to]; i < fanOffset[to + 1]; i++) {
+                uint32_t t = fans[i] * 3;
+                if (indices[t] == DEAD) continue;
+                int k = corner(t, to);
+                toRing.push_back(indices[t + (k + 1) % 3]);
+                toRing.push_back(indices[t + (k + 2) % 3]);
+            }
+            for (auto* ring : {&opposite, &fromRing, &toRing}) {
+                std::sort(ring->begin(), ring->end());
+                ring->erase(std::unique(ring->begin(), ring->end()), ring->end());
+            }
+            common.clear();
+            std::set_intersection(fromRing.begin(), fromRing.end(), toRing.begin(), toRing.end(),
+                                  std::back_inserter(common));
+            return common == opposite;
+        }
+
+        // Returns the number of triangles removed. The triangle list of to
+        // is stale afterwards, so the caller keeps both ends out of the
+        // rest of the pass.
+        size_t collapse(uint32_t from, uint32_t to, int tex) {
+            size_t removed = 0;
+            for (uint32_t i = fanOffset[from]; i < fanOffset[from + 1]; i++) {
+                uint32_t t = fans[i] * 3;
+                if (indices[t] == DEAD) continue;
+                int k = corner(t, from);
+                if (indices[t + (k + 1) % 3] == to || indices[t + (k + 2) % 3] == to) {
+                    indices[t] = indices[t + 1] = indices[t + 2] = DEAD;
+                    removed++;
+                } else {
+                    indices[t + k] = to;
+                    corners[t + k] = tex;
+                }
+            }
+            quadrics[to].add(quadrics[from]);
+            return removed;
+        }
+
+        static constexpr uint32_t DEAD = UINT32_MAX;
+
+        void compact() {
+            size_t out = 0;
+            for (size_t t = 0; t < indices.size(); t += 3) {
+                if (indices[t] == DEAD) continue;
+                for (int k = 0; k < 3; k++) {
+                    indices[out + k] = indices[t + k];
+                    corners[out + k] = corners[t + k];
+                }
+                out += 3;
+            }
+            indices.resize(out);
+            corners.resize(out);
+        }
+    };
+};
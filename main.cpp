@@ -1,94 +1,40 @@
 #include "obj_parser.hpp"
+#include "mesh_cache.hpp"
+#include "lod.hpp"
 #include "renderer.hpp"
+#include "ascii.hpp"
+#include "latest_value.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
 #include <iostream>
 #include <string>
-#include <sstream>
 #include <cmath>
 #include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <vector>
 
 #ifdef _WIN32
 #include <windows.h>
 #include <conio.h>
 #else
+#include <cerrno>
+#include <poll.h>
 #include <unistd.h>
 #include <termios.h>
 #endif
 
-const float COLOR_FACTOR = 1.2;
-const float BRIGHTNESS_FACTOR = 0.3;
 const int SCREEN_WIDTH = 240;
 const int SCREEN_HEIGHT = 60;
 
-const char* intensityToChar(double i) {
-    i = 1.0 - i;
-    // static const std::string chars = " .:-+#%@";
-    static const std::string chars = "$@B%8&WM#*oahkbdpqwmZO0QLCJUYXzcvunxrjft/|()1{}[]?-_+~<>i!lI;:,. ";
-    int index = static_cast<int>(i * (chars.size() - 1) + 0.5);
-    if (index < 0) index = 0;
-    if (index >= static_cast<int>(chars.size())) index = static_cast<int>(chars.size()) - 1;
-    static char buf[2] = {0};
-    buf[0] = chars[index];
-    return buf;
-}
-
-std::string buildAsciiImage(const Renderer& renderer) {
-    const std::string info_string = "[AD] Rotate, [WS] Zoom, [ESC] Exit";
-    const int charWidth = 2, charHeight = 1;
-    int outW = renderer.width / charWidth;
-    int outH = renderer.height / charHeight;
-
-    std::ostringstream oss;
-    for (int y = 0; y < outH; y++) {
-        for (int x = 0; x < outW; x++) {
-            double sumR = 0, sumG = 0, sumB = 0, sumI = 0;
-            int count = 0;
-            bool anyColor = false;
-            for (int dy = 0; dy < charHeight; dy++) {
-                for (int dx = 0; dx < charWidth; dx++) {
-                    int px = x * charWidth + dx;
-                    int py = y * charHeight + dy;
-                    if (px < renderer.width && py < renderer.height) {
-                        int idx = py * renderer.width + px;
-                        if (renderer.framebuffer[idx].depth < 1e10) {
-                            if (renderer.framebuffer[idx].hasColor) {
-                                sumR += renderer.framebuffer[idx].r;
-                                sumG += renderer.framebuffer[idx].g;
-                                sumB += renderer.framebuffer[idx].b;
-                                anyColor = true;
-                            } else {
-                                sumI += renderer.framebuffer[idx].intensity;
-                            }
-                            count++;
-                        }
-                    }
-                }
-            }
-            
-            if (count == 0) {
-                int r = 0, g = 0, b = 0, br = 0, bg = 0, bb = 0;
-                double avg = 0;
-                oss << "\033[48;2;" << br << ";" << bg << ";" << bb << "m\033[38;2;" << r << ";" << g << ";" << b << "m" << intensityToChar(avg);
-            } else if (anyColor) {
-                int r = std::min(255, std::max(0, static_cast<int>((sumR / count) * 255 * COLOR_FACTOR)));
-                int g = std::min(255, std::max(0, static_cast<int>((sumG / count) * 255 * COLOR_FACTOR)));
-                int b = std::min(255, std::max(0, static_cast<int>((sumB / count) * 255 * COLOR_FACTOR)));
-                int br = std::min(255, std::max(0, static_cast<int>(r * BRIGHTNESS_FACTOR)));
-                int bg = std::min(255, std::max(0, static_cast<int>(g * BRIGHTNESS_FACTOR)));
-                int bb = std::min(255, std::max(0, static_cast<int>(b * BRIGHTNESS_FACTOR)));
-                double avg = (r + g + b) / (255.0 * 3);
-                oss << "\033[48;2;" << br << ";" << bg << ";" << bb << "m\033[38;2;" << r << ";" << g << ";" << b << "m" << intensityToChar(avg);
-            } else {
-                double avg = sumI / count;
-                int level = std::max(0, std::min(5, static_cast<int>(avg * 5)));
-                int gray = std::min(255, 232 + level * 4);
-                int bgGray = std::max(232, gray - 12);
-                oss << "\033[48;5;" << bgGray << "m\033[38;5;" << gray << "m" << intensityToChar(avg);
-            }
-        }
-        oss << "\033[0m\n";
-    }
-    oss << "\033[0m\n" << info_string;
-    return oss.str();
+// Nearest-rank percentile, p in (0, 1]
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+    return values[std::min(values.size(), std::max<size_t>(rank, 1)) - 1];
 }
 
 int main(int argc, char* argv[]) {
@@ -100,29 +46,65 @@ int main(int argc, char* argv[]) {
     SetConsoleMode(hOut, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
 #endif
 
-    std::string objPath;
-    if (argc >= 2) {
-        objPath = argv[1];
-    } else {
+    std::string objPath, cacheDir, tracePath;
+    bool useCache = true;
+    bool useLod = true;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    ColorMode colorMode = ColorMode::TrueColor;
+    int targetFps = 60;
+    int benchFrames = 0;
+    bool showStats = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--no-cache") useCache = false;
+        else if (arg == "--no-lod") useLod = false;
+        else if (arg.rfind("--color=", 0) == 0) {
+            if (!parseColorMode(arg.substr(8), colorMode)) {
+                std::cerr << "Unknown color mode " << arg.substr(8) << " (truecolor, 256, 16, mono)" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--stats") showStats = true;
+        else if (arg.rfind("--trace=", 0) == 0) tracePath = arg.substr(8);
+        else if (arg == "--bench") benchFrames = 240;
+        else if (arg.rfind("--bench=", 0) == 0) benchFrames = std::max(1, std::atoi(arg.c_str() + 8));
+        else if (arg.rfind("--fps=", 0) == 0) targetFps = std::max(1, std::atoi(arg.c_str() + 6));
+        else if (arg.rfind("--threads=", 0) == 0) threads = std::max(1, std::atoi(arg.c_str() + 10));
+        else if (arg.rfind("--cache-dir=", 0) == 0) cacheDir = arg.substr(12);
+        else objPath = arg;
+    }
+    if (objPath.empty()) {
         std::cout << "Enter OBJ file path: ";
         std::getline(std::cin, objPath);
     }
 
+    if (!tracePath.empty()) {
+        Trace::start();
+        Trace::setThreadName("main");
+    }
+
+    // The cache holds the LOD levels as well; a hit without them (saved
+    // under --no-lod) builds them and saves again
     Mesh mesh;
-    if (!mesh.load(objPath)) {
+    LodChain lods;
+    double loadStart = nowSeconds();
+    std::string cachePath = MeshCache::pathFor(objPath, cacheDir);
+    bool cacheHit = useCache && MeshCache::load(cachePath, objPath, mesh, useLod ? &lods : nullptr);
+    if (!cacheHit && !mesh.load(objPath, threads)) {
         std::cerr << "Load failed" << std::endl;
         return 1;
     }
+    double loadSeconds = nowSeconds() - loadStart;
 
-    Vec3 minV(1e30, 1e30, 1e30), maxV(-1e30, -1e30, -1e30);
-    for (const auto& v : mesh.vertices) {
-        minV.x = std::min(minV.x, v.x);
-        minV.y = std::min(minV.y, v.y);
-        minV.z = std::min(minV.z, v.z);
-        maxV.x = std::max(maxV.x, v.x);
-        maxV.y = std::max(maxV.y, v.y);
-        maxV.z = std::max(maxV.z, v.z);
-    }
+    double lodStart = nowSeconds();
+    bool lodCached = lods.ready();
+    if (!lodCached) lods.build(mesh, threads, useLod ? LodChain::MAX_LEVELS : 1);
+    double lodSeconds = nowSeconds() - lodStart;
+    if (useCache && (!cacheHit || (useLod && !lodCached)))
+        MeshCache::save(cachePath, objPath, mesh, useLod ? &lods : nullptr);
+
+    Vec3 minV, maxV;
+    mesh.bounds(minV, maxV);
     Vec3 center = (minV + maxV) * 0.5;
     double size = std::max({maxV.x - minV.x, maxV.y - minV.y, maxV.z - minV.z});
     if (size < 1e-6) size = 1.0;
@@ -135,39 +117,257 @@ int main(int argc, char* argv[]) {
 
     int pixelW = std::max(1, SCREEN_WIDTH), pixelH = std::max(1, SCREEN_HEIGHT);
     Renderer renderer(pixelW, pixelH);
+    renderer.setThreads(threads);
     const double rotSpeed = 0.05;
     const double zoomSpeed = 1.05;
 
-    double rotX = 0, rotY = 0;
-    double cameraDist = 3.0;
-
-    {
-        Vec3 eye(0, 0, cameraDist);
+    struct Camera {
+        double rotX = 0, rotY = 0;
+        double cameraDist = 3.0;
+        bool showStats = false;
+    };
+    auto viewProjFor = [&](const Camera& cam) {
+        Vec3 eye(0, 0, cam.cameraDist);
         Mat4 view = Mat4::lookAt(eye, target, up);
-        Mat4 rot = Mat4::rotateY(rotY) * Mat4::rotateX(rotX);
+        Mat4 rot = Mat4::rotateY(cam.rotY) * Mat4::rotateX(cam.rotX);
         Mat4 model = rot * baseModel;
-        renderer.viewProj = proj * view * model;
-        renderer.render(mesh);
-        std::cout << buildAsciiImage(renderer);
+        return proj * view * model;
+    };
+
+    // Headless run over a fixed orbit: one full turn while the camera swings
+    // between distance 3 and 1.5. Nothing is written to the terminal.
+    if (benchFrames > 0) {
+        const double pi = 3.14159265358979323846;
+        const std::string info = "[AD] Rotate, [WS] Zoom, [ESC] Exit";
+        AsciiFrame ascii;
+        TerminalPresenter presenter;
+        std::vector<double> transformMs, rasterMs, encodeMs, frameMs;
+        size_t bytes = 0;
+        RasterStats total;
+        size_t lodSum = 0;
+        for (int f = -1; f < benchFrames; f++) {  // frame -1 warms up buffers
+            double t = std::max(0, f) / static_cast<double>(benchFrames);
+            Camera cam;
+            cam.rotY = 2 * pi * t;
+            cam.cameraDist = 2.25 + 0.75 * std::cos(2 * pi * t);
+            renderer.viewProj = viewProjFor(cam);
+            size_t level = lods.select(renderer.viewProj, pixelW, pixelH);
+            const Mesh& drawn = lods.level(level);
+
+            double t0 = nowSeconds();
+            renderer.transformVertices(drawn);
+            double t1 = nowSeconds();
+            renderer.rasterize(drawn, lods.texture());
+            double t2 = nowSeconds();
+            size_t frameBytes;
+            {
+                TraceScope trace("encode");
+                buildAsciiFrame(renderer.frame, ascii, colorMode);
+                frameBytes = presenter.present(ascii, info).size();
+            }
+            double t3 = nowSeconds();
+            if (f < 0) continue;
+
+            transformMs.push_back((t1 - t0) * 1e3);
+            rasterMs.push_back((t2 - t1) * 1e3);
+            encodeMs.push_back((t3 - t2) * 1e3);
+            frameMs.push_back((t3 - t0) * 1e3);
+            bytes += frameBytes;
+            total.add(renderer.stats);
+            lodSum += level;
+        }
+
+        std::printf("mesh      %s: %zu vertices, %zu triangles\n", objPath.c_str(), mesh.vertices.size(),
+                    mesh.triangles.size());
+        std::printf("load      %.2f ms (%s)\n", loadSeconds * 1e3, cacheHit ? "cache" : "parsed");
+        std::string lodTriangles;
+        for (size_t i = 0; i < lods.levels(); i++)
+            lodTriangles += (i ? "/" : "") + std::to_string(lods.level(i).triangles.size());
+        std::printf("lod       %zu levels (%s triangles) %s in %.2f ms, mean level drawn %.2f\n", lods.levels(),
+                    lodTriangles.c_str(), lodCached ? "cached" : "built", lodSeconds * 1e3,
+                    static_cast<double>(lodSum) / benchFrames);
+        std::printf("frames    %d at %dx%d, %u threads, %.0f bytes/frame\n", benchFrames, pixelW, pixelH,
+                    threads, static_cast<double>(bytes) / benchFrames);
+        std::printf("%-9s %9s %9s %9s %9s  (ms)\n", "stage", "mean", "p50", "p95", "p99");
+        auto report = [](const char* name, const std::vector<double>& ms) {
+            double sum = 0;
+            for (double v : ms) sum += v;
+            std::printf("%-9s %9.3f %9.3f %9.3f %9.3f\n", name, sum / ms.size(), percentile(ms, 0.50),
+                        percentile(ms, 0.95), percentile(ms, 0.99));
+        };
+        report("transform", transformMs);
+        report("raster", rasterMs);
+        report("encode", encodeMs);
+        report("frame", frameMs);
+        std::printf("per frame %.0f triangles submitted, %.0f culled, %.0f clipped, %.0f drawn small, "
+                    "%.0f scanned, %.0f pixels shaded, %.1f%% depth pass\n",
+                    static_cast<double>(total.trianglesSubmitted) / benchFrames,
+                    static_cast<double>(total.trianglesCulled) / benchFrames,
+                    static_cast<double>(total.trianglesClipped) / benchFrames,
+                    static_cast<double>(total.trianglesSmall) / benchFrames,
+                    static_cast<double>(total.trianglesTested - total.trianglesSmall) / benchFrames,
+                    static_cast<double>(total.pixelsShaded) / benchFrames,
+                    total.pixelsTested ? 100.0 * total.pixelsShaded / total.pixelsTested : 0.0);
+        if (!tracePath.empty() && !Trace::write(tracePath)) std::cerr << "Cannot write " << tracePath << std::endl;
+        return 0;
     }
 
-#ifdef _WIN32
-    while (true) {
-        int c = _getch();
-        if (c == 27) break;
-        if (c == 'w' || c == 'W') cameraDist = std::max(0.2, cameraDist / zoomSpeed);
-        if (c == 's' || c == 'S') cameraDist = std::min(50.0, cameraDist * zoomSpeed);
-        if (c == 'a' || c == 'A') rotY += rotSpeed;
-        if (c == 'd' || c == 'D') rotY -= rotSpeed;
-
-        Vec3 eye(0, 0, cameraDist);
-        Mat4 view = Mat4::lookAt(eye, target, up);
-        Mat4 rot = Mat4::rotateY(rotY) * Mat4::rotateX(rotX);
-        Mat4 model = rot * baseModel;
-        renderer.viewProj = proj * view * model;
-        renderer.render(mesh);
+    // Rendering, cell conversion and terminal output each run on their own
+    // thread and hand frames on through LatestValue slots, so a slow terminal
+    // never holds up rendering and stale intermediate frames are skipped.
+    // The on-screen diff lives in the output stage, which is the only one
+    // that knows what the terminal is actually showing.
+    // Frames carry their counters and stage times down the pipeline so the
+    // overlay describes the frame it is drawn with
+    struct RenderedFrame {
+        FrameBuffer frame;
+        RasterStats stats;
+        StageTimes times;
+        size_t lodLevel = 0;
+        bool showStats = false;
+    };
+    struct EncodedFrame {
+        AsciiFrame cells;
+        RasterStats stats;
+        StageTimes times;
+        size_t lodLevel = 0;
+        bool showStats = false;
+    };
+    LatestValue<Camera> cameras;
+    LatestValue<RenderedFrame> frames;
+    LatestValue<EncodedFrame> asciiFrames;
+
+    std::thread renderThread([&] {
+        Trace::setThreadName("render");
+        while (const Camera* cam = cameras.waitLatest()) {
+            renderer.setProfiling(cam->showStats);
+            renderer.viewProj = viewProjFor(*cam);
+            renderer.render(lods);
+            RenderedFrame& out = frames.writeSlot();
+            out.frame = renderer.frame;
+            out.stats = renderer.stats;
+            out.times = renderer.times;
+            out.lodLevel = renderer.lodLevel;
+            out.showStats = cam->showStats;
+            frames.publish();
+        }
+        frames.close();
+    });
+
+    std::thread encodeThread([&] {
+        Trace::setThreadName("encode");
+        while (const RenderedFrame* in = frames.waitLatest()) {
+            EncodedFrame& out = asciiFrames.writeSlot();
+            out.stats = in->stats;
+            out.times = in->times;
+            out.lodLevel = in->lodLevel;
+            out.showStats = in->showStats;
+            {
+                ScopedTimer timer(in->showStats ? &out.times.encode : nullptr);
+                TraceScope trace("encode");
+                buildAsciiFrame(in->frame, out.cells, colorMode);
+            }
+            asciiFrames.publish();
+        }
+        asciiFrames.close();
+    });
+
+    std::thread outputThread([&] {
+        Trace::setThreadName("output");
+        const std::string info_string = "[AD] Rotate, [WS] Zoom, [I] Stats, [ESC] Exit";
+        TerminalPresenter presenter;
+        std::string info;
+        std::vector<std::string> overlay(2), noOverlay;
+        size_t lastBytes = 0;
+        double lastOutput = 0;
+        char line[256];
+        while (const EncodedFrame* in = asciiFrames.waitLatest()) {
+            info = info_string;
+            info += "  |  ";
+            info += std::to_string(lastBytes);
+            info += " bytes/frame";
+            if (in->showStats) {
+                // Output time and bytes are the previous frame's; this one is not written yet
+                StageTimes t = in->times;
+                t.output = lastOutput;
+                const RasterStats& st = in->stats;
+                std::snprintf(line, sizeof(line),
+                              "frame %6.2f ms  transform %5.2f  raster %6.2f  encode %5.2f  output %5.2f",
+                              t.total() * 1e3, t.transform * 1e3, t.raster * 1e3, t.encode * 1e3, t.output * 1e3);
+                overlay[0] = line;
+                std::snprintf(line, sizeof(line),
+                              "lod %zu  |  triangles %llu submitted  %llu culled  %llu clipped  %llu rasterized "
+                              "(%llu small, %llu scanned)  |  pixels %llu shaded  %.1f%% depth pass",
+                              in->lodLevel,
+                              static_cast<unsigned long long>(st.trianglesSubmitted),
+                              static_cast<unsigned long long>(st.trianglesCulled),
+                              static_cast<unsigned long long>(st.trianglesClipped),
+                              static_cast<unsigned long long>(st.trianglesSubmitted - st.trianglesCulled),
+                              static_cast<unsigned long long>(st.trianglesSmall),
+                              static_cast<unsigned long long>(st.trianglesTested - st.trianglesSmall),
+                              static_cast<unsigned long long>(st.pixelsShaded),
+                              st.pixelsTested ? 100.0 * st.pixelsShaded / st.pixelsTested : 0.0);
+                overlay[1] = line;
+            }
+            double outputStart = in->showStats ? nowSeconds() : 0;
+            const OutputBuffer* out;
+            {
+                TraceScope trace("present");
+                out = &presenter.present(in->cells, info, in->showStats ? overlay : noOverlay);
+            }
+            lastBytes = out->size();
+            {
+                TraceScope trace("write");
+                out->writeToStdout();
+            }
+            if (in->showStats) lastOutput = nowSeconds() - outputStart;
+        }
+    });
 
-        std::cout << "\033[2J\033[H" << buildAsciiImage(renderer);
+    // Input is drained as it arrives, but the accumulated camera is handed to
+    // the renderer at most once per frame interval, so held keys turn into
+    // one render per tick instead of one render per key repeat
+    using Clock = std::chrono::steady_clock;
+    const Clock::duration frameInterval =
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+    Camera camera;
+    camera.showStats = showStats;
+    bool running = true, dirty = false;
+    Clock::time_point nextFrame = Clock::now();
+    auto applyKey = [&](int c) {
+        if (c == 27) running = false;
+        else if (c == 'w' || c == 'W') camera.cameraDist = std::max(0.2, camera.cameraDist / zoomSpeed);
+        else if (c == 's' || c == 'S') camera.cameraDist = std::min(50.0, camera.cameraDist * zoomSpeed);
+        else if (c == 'a' || c == 'A') camera.rotY += rotSpeed;
+        else if (c == 'd' || c == 'D') camera.rotY -= rotSpeed;
+        else if (c == 'i' || c == 'I') camera.showStats = !camera.showStats;
+        else return;
+        dirty = true;
+    };
+    auto publishIfDue = [&] {
+        Clock::time_point now = Clock::now();
+        if (!dirty || now < nextFrame) return;
+        cameras.writeSlot() = camera;
+        cameras.publish();
+        dirty = false;
+        nextFrame = now + frameInterval;
+    };
+    // Milliseconds until the pending camera is due, or -1 when nothing is pending
+    auto msUntilFrame = [&]() -> int {
+        if (!dirty) return -1;
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nextFrame - Clock::now()).count();
+        return static_cast<int>(std::max<long long>(0, wait + 1));
+    };
+    dirty = true;
+    publishIfDue();
+
+#ifdef _WIN32
+    while (running) {
+        while (running && _kbhit()) applyKey(_getch());
+        if (!running) break;
+        publishIfDue();
+        int wait = msUntilFrame();
+        std::this_thread::sleep_for(std::chrono::milliseconds(wait < 0 ? 5 : std::min(wait, 5)));
     }
 #else
     struct termios oldT, newT;
@@ -176,26 +376,27 @@ int main(int argc, char* argv[]) {
     newT.c_lflag &= ~(ICANON | ECHO);
     tcsetattr(STDIN_FILENO, TCSANOW, &newT);
 
-    while (true) {
-        char c;
-        if (read(STDIN_FILENO, &c, 1) <= 0) continue;
-        if (c == 27) break;
-        if (c == 'w' || c == 'W') cameraDist = std::max(0.2, cameraDist / zoomSpeed);
-        if (c == 's' || c == 'S') cameraDist = std::min(50.0, cameraDist * zoomSpeed);
-        if (c == 'a' || c == 'A') rotY += rotSpeed;
-        if (c == 'd' || c == 'D') rotY -= rotSpeed;
-
-        Vec3 eye(0, 0, cameraDist);
-        Mat4 view = Mat4::lookAt(eye, target, up);
-        Mat4 rot = Mat4::rotateY(rotY) * Mat4::rotateX(rotX);
-        Mat4 model = rot * baseModel;
-        renderer.viewProj = proj * view * model;
-        renderer.render(mesh);
-
-        std::cout << "\033[2J\033[H" << buildAsciiImage(renderer);
+    while (running) {
+        pollfd in = {STDIN_FILENO, POLLIN, 0};
+        int ready = poll(&in, 1, msUntilFrame());
+        if (ready < 0 && errno != EINTR) break;
+        if (ready > 0) {
+            char buf[256];
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n == 0) break;  // stdin closed
+            for (ssize_t i = 0; i < n && running; i++) applyKey(static_cast<unsigned char>(buf[i]));
+            if (!running) break;
+        }
+        publishIfDue();
     }
     tcsetattr(STDIN_FILENO, TCSANOW, &oldT);
 #endif
+    cameras.close();
+    renderThread.join();
+    encodeThread.join();
+    outputThread.join();
+    std::cout << "\033[0m\n" << std::flush;
+    if (!tracePath.empty() && !Trace::write(tracePath)) std::cerr << "Cannot write " << tracePath << std::endl;
 
     return 0;
 }
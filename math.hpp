@@ -2,6 +2,7 @@
 
 #include <cmath>
 #include <algorithm>
+#include <cstddef>
 
 // 3D vector
 struct Vec3 {
@@ -27,6 +28,20 @@ struct Vec3 {
     }
 };
 
+// Homogeneous point, e.g. a clip-space position before the perspective divide
+struct Vec4 {
+    double x, y, z, w;
+
+    Vec4() : x(0), y(0), z(0), w(0) {}
+    Vec4(double x, double y, double z, double w) : x(x), y(y), z(z), w(w) {}
+
+    // Perspective divide, with the same |w| clamp as Mat4::transformPoint
+    Vec3 project() const {
+        double d = std::abs(w) < 1e-10 ? 1e-10 : w;
+        return Vec3(x / d, y / d, z / d);
+    }
+};
+
 // 4x4 matrix (column-major)
 struct Mat4 {
     double m[16];
@@ -105,6 +120,20 @@ struct Mat4 {
         return mat;
     }
     
+    // Clip-space position; transformPoint(p) == transformClip(p).project()
+    Vec4 transformClip(const Vec3& p) const {
+        return Vec4(m[0]*p.x + m[4]*p.y + m[8]*p.z + m[12],
+                    m[1]*p.x + m[5]*p.y + m[9]*p.z + m[13],
+                    m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14],
+                    m[3]*p.x + m[7]*p.y + m[11]*p.z + m[15]);
+    }
+
+    // out[i] = transformClip(in[i]) for a whole array. The divide (and any
+    // clipping decision) is left to the caller, so the loop has no branches.
+    void transformPoints(const Vec3* in, Vec4* out, size_t count) const {
+        for (size_t i = 0; i < count; i++) out[i] = transformClip(in[i]);
+    }
+
     Vec3 transformPoint(const Vec3& p) const {
         double w = m[3]*p.x + m[7]*p.y + m[11]*p.z + m[15];
         if (std::abs(w) < 1e-10) w = 1e-10;
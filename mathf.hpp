@@ -0,0 +1,169 @@
+#pragma once
+
+// Single-precision counterparts of Vec3/Mat4 for per-frame vertex work,
+// with batch operations vectorized with SSE where available. The double
+// types in math.hpp stay in use for load-time math and triangle setup.
+
+#include "math.hpp"
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATHF_SSE
+#include <emmintrin.h>
+#endif
+
+// Packed 3-float vector, 12 bytes so arrays of positions stay dense
+struct Vec3f {
+    float x, y, z;
+
+    Vec3f() : x(0), y(0), z(0) {}
+    Vec3f(float x, float y, float z) : x(x), y(y), z(z) {}
+    explicit Vec3f(const Vec3& v)
+        : x(static_cast<float>(v.x)), y(static_cast<float>(v.y)), z(static_cast<float>(v.z)) {}
+
+    Vec3f operator+(const Vec3f& v) const { return Vec3f(x + v.x, y + v.y, z + v.z); }
+    Vec3f operator-(const Vec3f& v) const { return Vec3f(x - v.x, y - v.y, z - v.z); }
+    Vec3f operator*(float s) const { return Vec3f(x * s, y * s, z * s); }
+
+    float dot(const Vec3f& v) const { return x * v.x + y * v.y + z * v.z; }
+    Vec3f cross(const Vec3f& v) const {
+        return Vec3f(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
+    }
+
+    float length() const { return std::sqrt(x * x + y * y + z * z); }
+    Vec3f normalized() const {
+        float len = length();
+        return len > 1e-10f ? Vec3f(x / len, y / len, z / len) : Vec3f();
+    }
+
+    Vec3 toDouble() const { return Vec3(x, y, z); }
+};
+
+static_assert(sizeof(Vec3f) == 12, "Vec3f arrays must be tightly packed");
+
+struct alignas(16) Vec4f {
+    float x, y, z, w;
+
+    Vec4f() : x(0), y(0), z(0), w(0) {}
+    Vec4f(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+
+    // Perspective divide, with the same |w| clamp as Mat4f::transformPoint
+    Vec3f project() const {
+        float d = std::abs(w) < 1e-10f ? 1e-10f : w;
+        return Vec3f(x / d, y / d, z / d);
+    }
+};
+
+// 4x4 column-major matrix, same layout as Mat4
+struct alignas(32) Mat4f {
+    float m[16];
+
+    Mat4f() {
+        for (int i = 0; i < 16; i++) m[i] = 0;
+        m[0] = m[5] = m[10] = m[15] = 1;
+    }
+
+    explicit Mat4f(const Mat4& d) {
+        for (int i = 0; i < 16; i++) m[i] = static_cast<float>(d.m[i]);
+    }
+
+    Mat4f operator*(const Mat4f& b) const {
+        Mat4f r;
+        for (int col = 0; col < 4; col++) {
+            for (int row = 0; row < 4; row++) {
+                float sum = 0;
+                for (int k = 0; k < 4; k++) sum += m[k * 4 + row] * b.m[col * 4 + k];
+                r.m[col * 4 + row] = sum;
+            }
+        }
+        return r;
+    }
+
+    Vec4f transformClip(const Vec3f& p) const {
+        return Vec4f(m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12],
+                     m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13],
+                     m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14],
+                     m[3] * p.x + m[7] * p.y + m[11] * p.z + m[15]);
+    }
+
+    // out[i] = transformClip(in[i]) for i in [0, count), four vertices per
+    // step; the divide is left to the caller. Results match transformClip.
+    void transformPoints(const Vec3f* in, Vec4f* out, size_t count) const {
+        size_t i = 0;
+#ifdef MATHF_SSE
+        __m128 col[16];
+        for (int k = 0; k < 16; k++) col[k] = _mm_set1_ps(m[k]);
+        for (; i + 4 <= count; i += 4) {
+            const Vec3f* p = in + i;
+            __m128 x = _mm_setr_ps(p[0].x, p[1].x, p[2].x, p[3].x);
+            __m128 y = _mm_setr_ps(p[0].y, p[1].y, p[2].y, p[3].y);
+            __m128 z = _mm_setr_ps(p[0].z, p[1].z, p[2].z, p[3].z);
+            __m128 r[4];
+            for (int row = 0; row < 4; row++)
+                r[row] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(col[row], x), _mm_mul_ps(col[4 + row], y)),
+                                               _mm_mul_ps(col[8 + row], z)),
+                                    col[12 + row]);
+            _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+            for (int k = 0; k < 4; k++) _mm_store_ps(&out[i + k].x, r[k]);
+        }
+#endif
+        for (; i < count; i++) out[i] = transformClip(in[i]);
+    }
+
+    // Same semantics as Mat4::transformPoint, including the |w| clamp
+    Vec3f transformPoint(const Vec3f& p) const {
+        float w = m[3] * p.x + m[7] * p.y + m[11] * p.z + m[15];
+        if (std::abs(w) < 1e-10f) w = 1e-10f;
+        return Vec3f((m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12]) / w,
+                     (m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13]) / w,
+                     (m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14]) / w);
+    }
+
+    // out[i] = transformPoint(in[i]) for i in [0, count); in and out may alias
+    void transformPoints(const Vec3f* in, Vec3f* out, size_t count) const {
+#ifdef MATHF_SSE
+        const __m128 c0 = _mm_load_ps(m), c1 = _mm_load_ps(m + 4);
+        const __m128 c2 = _mm_load_ps(m + 8), c3 = _mm_load_ps(m + 12);
+        const __m128 tiny = _mm_set1_ps(1e-10f);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        for (size_t i = 0; i < count; i++) {
+            // Summed in the same order as transformPoint, so results match it
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(in[i].x)),
+                                                        _mm_mul_ps(c1, _mm_set1_ps(in[i].y))),
+                                             _mm_mul_ps(c2, _mm_set1_ps(in[i].z))),
+                                  c3);
+            __m128 w = _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3));
+            __m128 small = _mm_cmplt_ps(_mm_and_ps(w, absMask), tiny);
+            w = _mm_or_ps(_mm_and_ps(small, tiny), _mm_andnot_ps(small, w));
+            alignas(16) float v[4];
+            _mm_store_ps(v, _mm_div_ps(r, w));
+            out[i] = Vec3f(v[0], v[1], v[2]);
+        }
+#else
+        for (size_t i = 0; i < count; i++) out[i] = transformPoint(in[i]);
+#endif
+    }
+};
+
+// v[i] = v[i].normalized() for i in [0, count), four vectors per step
+inline void normalizeVectors(Vec3f* v, size_t count) {
+    size_t i = 0;
+#ifdef MATHF_SSE
+    const __m128 tiny = _mm_set1_ps(1e-10f);
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_setr_ps(v[i].x, v[i + 1].x, v[i + 2].x, v[i + 3].x);
+        __m128 y = _mm_setr_ps(v[i].y, v[i + 1].y, v[i + 2].y, v[i + 3].y);
+        __m128 z = _mm_setr_ps(v[i].z, v[i + 1].z, v[i + 2].z, v[i + 3].z);
+        __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        __m128 keep = _mm_cmpgt_ps(len, tiny);
+        __m128 safe = _mm_or_ps(_mm_and_ps(keep, len), _mm_andnot_ps(keep, _mm_set1_ps(1)));
+        alignas(16) float rx[4], ry[4], rz[4];
+        _mm_store_ps(rx, _mm_and_ps(keep, _mm_div_ps(x, safe)));
+        _mm_store_ps(ry, _mm_and_ps(keep, _mm_div_ps(y, safe)));
+        _mm_store_ps(rz, _mm_and_ps(keep, _mm_div_ps(z, safe)));
+        for (int k = 0; k < 4; k++) v[i + k] = Vec3f(rx[k], ry[k], rz[k]);
+    }
+#endif
+    for (; i < count; i++) v[i] = v[i].normalized();
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "obj_parser.hpp"
+#include "lod.hpp"
+#include "mapped_file.hpp"
+#include "trace.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Binary snapshot of a loaded Mesh (geometry, cluster hierarchy and decoded
+// texture) and optionally its LOD levels, keyed by the source OBJ's path and
+// the size and modification time of the OBJ and of every material file it
+// read or looked for. Arrays are stored in native layout so a cache hit is a
+// single mapping and a few copies, with no cluster or LOD build.
+//
+// After the header come sections of a 64-bit element count and the elements,
+// padded to 8 bytes: OBJ path, material file paths ('\0'-terminated), file
+// stamps (OBJ first), texture bytes and LOD level errors, then the mesh and
+// each coarse level as vertices, normals, texture coordinates, triangles,
+// clusters, shared cluster vertices and their owners. Everything is checked
+// before the mesh is touched, so a corrupt or stale cache is just a miss.
+struct MeshCache {
+    static constexpr char MAGIC[8] = {'O', 'B', 'J', 'C', 'A', 'C', 'H', 'E'};
+    static constexpr uint32_t VERSION = 4;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t endianCheck;
+        int32_t texWidth, texHeight, texChannels;
+        int32_t lodLevels;  // coarse levels stored, -1 when the chain was not saved
+    };
+
+    // Size -1 for a missing file, whose appearance must invalidate the cache
+    struct FileStamp {
+        int64_t size, mtime;
+        bool operator==(const FileStamp& o) const { return size == o.size && mtime == o.mtime; }
+    };
+
+    // Full-resolution modification time, so edits within the second the
+    // cache was written still count
+    static FileStamp stamp(const std::string& path) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        if (ec) return {-1, 0};
+        auto mtime = std::filesystem::last_write_time(path, ec);
+        if (ec) return {-1, 0};
+        return {static_cast<int64_t>(size), static_cast<int64_t>(mtime.time_since_epoch().count())};
+    }
+
+    // "<obj>.meshcache" next to the OBJ, or a name hashed from the path in cacheDir
+    static std::string pathFor(const std::string& objPath, const std::string& cacheDir) {
+        if (cacheDir.empty()) return objPath + ".meshcache";
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.meshcache",
+                      static_cast<unsigned long long>(std::hash<std::string>()(objPath)));
+        char last = cacheDir.back();
+        return cacheDir + (last == '/' || last == '\\' ? "" : "/") + name;
+    }
+
+    static size_t align8(size_t n) { return (n + 7) & ~static_cast<size_t>(7); }
+
+    // Whether the renderer can draw mesh without reading out of bounds:
+    // every vertex index in range, texture coordinate and normal indices
+    // below their counts (negative ones mean absent), and width x height
+    // RGB texels
+    static bool consistent(const Mesh& mesh) {
+        const Texture& tex = mesh.texture;
+        if (tex.width < 0 || tex.height < 0 || (!tex.data.empty() && tex.channels != 3) ||
+            static_cast<uint64_t>(tex.width) * static_cast<uint64_t>(tex.height) * 3 != tex.data.size())
+            return false;
+        const int64_t vertexCount = static_cast<int64_t>(mesh.vertices.size());
+        const int64_t texCoordCount = static_cast<int64_t>(mesh.texCoords.size());
+        const int64_t normalCount = static_cast<int64_t>(mesh.normals.size());
+        for (const Triangle& t : mesh.triangles) {
+            for (int v : {t.v0, t.v1, t.v2})
+                if (v < 0 || v >= vertexCount) return false;
+            for (int c : {t.t0, t.t1, t.t2})
+                if (c >= texCoordCount) return false;
+            for (int n : {t.n0, t.n1, t.n2})
+                if (n >= normalCount) return false;
+        }
+        return true;
+    }
+
+    // Fills mesh and, when lods is given and the cache has levels, restores
+    // them onto mesh
+    static bool load(const std::string& cachePath, const std::string& objPath, Mesh& mesh,
+                     LodChain* lods = nullptr) {
+        TraceScope trace("MeshCache::load");
+        MappedFile file;
+        if (!file.open(cachePath) || file.size() < sizeof(Header)) return false;
+        Header h;
+        std::memcpy(&h, file.data(), sizeof(Header));
+        if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION || h.endianCheck != 0x01020304u)
+            return false;
+
+        Reader in{file.data() + sizeof(Header), file.data() + file.size()};
+        std::vector<char> path, names;
+        std::vector<FileStamp> stamps;
+        if (!in.read(path) || std::string(path.begin(), path.end()) != objPath) return false;
+        if (!in.read(names) || (!names.empty() && names.back() != '\0') || !in.read(stamps)) return false;
+
+        // Stamps must match the files as they are now
+        std::vector<std::string> materialFiles;
+        for (size_t begin = 0; begin < names.size();) {
+            materialFiles.emplace_back(&names[begin]);
+            begin += materialFiles.back().size() + 1;
+        }
+        if (stamps.size() != materialFiles.size() + 1 || stamps[0].size < 0 || !(stamps[0] == stamp(objPath)))
+            return false;
+        for (size_t i = 0; i < materialFiles.size(); i++)
+            if (!(stamps[i + 1] == stamp(materialFiles[i]))) return false;
+
+        Mesh loaded;
+        std::vector<double> errors;
+        if (!in.read(loaded.texture.data) || !in.read(errors) ||
+            errors.size() != static_cast<size_t>(std::max(0, h.lodLevels)))
+            return false;
+        loaded.texture.width = h.texWidth;
+        loaded.texture.height = h.texHeight;
+        loaded.texture.channels = h.texChannels;
+        if (!readMesh(in, loaded)) return false;
+        std::vector<LodChain::Level> levels(errors.size());
+        for (size_t i = 0; i < levels.size(); i++) {
+            levels[i].error = errors[i];
+            if (!readMesh(in, levels[i].mesh)) return false;
+        }
+        if (in.p != in.end) return false;
+
+        loaded.materialFiles = std::move(materialFiles);
+        mesh = std::move(loaded);
+        if (lods && h.lodLevels >= 0) lods->restore(mesh, std::move(levels));
+        return true;
+    }
+
+    // Saves lods too when given; they must have been built from mesh.
+    // Written to a temporary file first so readers never see a partial cache.
+    static bool save(const std::string& cachePath, const std::string& objPath, const Mesh& mesh,
+                     const LodChain* lods = nullptr) {
+        TraceScope trace("MeshCache::save");
+        if (!consistent(mesh)) return false;
+        std::vector<double> errors;
+        if (lods) {
+            for (const LodChain::Level& level : lods->coarseLevels()) {
+                if (!consistent(level.mesh)) return false;
+                errors.push_back(level.error);
+            }
+        }
+        Header h = {};
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = VERSION;
+        h.endianCheck = 0x01020304u;
+        h.texWidth = mesh.texture.width;
+        h.texHeight = mesh.texture.height;
+        h.texChannels = mesh.texture.channels;
+        h.lodLevels = lods ? static_cast<int32_t>(errors.size()) : -1;
+
+        std::vector<FileStamp> stamps = {stamp(objPath)};
+        if (stamps[0].size < 0) return false;
+        std::string names;
+        for (const std::string& name : mesh.materialFiles) {
+            names.append(name.c_str(), name.size() + 1);
+            stamps.push_back(stamp(name));
+        }
+
+        std::string tmpPath = cachePath + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return false;
+            Writer w{out};
+            out.write(reinterpret_cast<const char*>(&h), sizeof(Header));
+            w.write(objPath.data(), objPath.size());
+            w.write(names.data(), names.size());
+            w.write(stamps);
+            w.write(mesh.texture.data);
+            w.write(errors);
+            writeMesh(w, mesh);
+            if (lods)
+                for (const LodChain::Level& level : lods->coarseLevels()) writeMesh(w, level.mesh);
+            if (!out.good()) {
+                out.close();
+                std::remove(tmpPath.c_str());
+                return false;
+            }
+        }
+#ifdef _WIN32
+        std::remove(cachePath.c_str());
+#endif
+        if (std::rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Writer {
+        std::ofstream& out;
+
+        template <typename T>
+        void write(const T* data, uint64_t count) {
+            static const char zeros[8] = {0};
+            size_t bytes = count * sizeof(T);
+            out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            if (bytes) out.write(reinterpret_cast<const char*>(data), bytes);
+            out.write(zeros, align8(bytes) - bytes);
+        }
+
+        template <typename T>
+        void write(const std::vector<T>& v) { write(v.data(), v.size()); }
+    };
+
+    // Bounds-checked walk over the sections of a mapped cache
+    struct Reader {
+        const char* p;
+        const char* end;
+
+        template <typename T>
+        bool read(std::vector<T>& out) {
+            uint64_t count;
+            if (static_cast<size_t>(end - p) < sizeof(count)) return false;
+            std::memcpy(&count, p, sizeof(count));
+            p += sizeof(count);
+            size_t left = static_cast<size_t>(end - p);
+            if (count > left / sizeof(T) || align8(count * sizeof(T)) > left) return false;
+            out.resize(count);
+            if (count) std::memcpy(out.data(), p, count * sizeof(T));
+            p += align8(count * sizeof(T));
+            return true;
+        }
+    };
+
+    // Geometry and clusters of one mesh; the texture is stored once, ahead
+    // of the meshes
+    static void writeMesh(Writer& w, const Mesh& mesh) {
+        w.write(mesh.vertices);
+        w.write(mesh.normals);
+        w.write(mesh.texCoords);
+        w.write(mesh.triangles);
+        w.write(mesh.clusters.clusters);
+        w.write(mesh.clusters.sharedVertices);
+        w.write(mesh.clusters.sharedOwners);
+    }
+
+    // Counterpart of writeMesh into an empty mesh (texture already set),
+    // validating indices and clusters and adding the render data
+    static bool readMesh(Reader& in, Mesh& mesh) {
+        std::vector<MeshCluster> clusters;
+        std::vector<uint32_t> shared, owners;
+        if (!in.read(mesh.vertices) || !in.read(mesh.normals) || !in.read(mesh.texCoords) ||
+            !in.read(mesh.triangles) || !in.read(clusters) || !in.read(shared) || !in.read(owners))
+            return false;
+        if (mesh.vertices.empty() || mesh.triangles.empty() || !consistent(mesh) ||
+            !mesh.clusters.assign(std::move(clusters), std::move(shared), std::move(owners), mesh.triangles,
+                                  mesh.vertices.size()))
+            return false;
+        mesh.computeVertexData();
+        return true;
+    }
+};
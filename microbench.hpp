@@ -0,0 +1,99 @@
+#pragma once
+
+// Minimal Google Benchmark-style harness for viewer_bench:
+//
+//   static void BM_Thing(BenchState& state) {
+//       setup...
+//       for ([[maybe_unused]] auto _ : state) doNotOptimize(thing());
+//   }
+//   MICRO_BENCHMARK(BM_Thing);
+//
+// Only the loop is timed. The iteration count grows until a run lasts at
+// least the minimum time, and the time per iteration of that run is reported.
+
+#include "profile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Keep the compiler from discarding a value or hoisting its computation
+template <typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile char sink;
+    sink = *reinterpret_cast<const volatile char*>(&value);
+#endif
+}
+
+class BenchState {
+public:
+    explicit BenchState(uint64_t iterations) : count(iterations) {}
+
+    struct Iterator {
+        BenchState* state;
+        uint64_t left;
+
+        bool operator!=(const Iterator&) {
+            if (left) return true;
+            state->stop = nowSeconds();
+            return false;
+        }
+        void operator++() { left--; }
+        int operator*() const { return 0; }
+    };
+
+    Iterator begin() {
+        start = nowSeconds();
+        return {this, count};
+    }
+    Iterator end() { return {this, 0}; }
+
+    uint64_t iterations() const { return count; }
+    double seconds() const { return stop - start; }
+
+private:
+    uint64_t count;
+    double start = 0, stop = 0;
+};
+
+using BenchFunction = void (*)(BenchState&);
+
+struct MicroBenchmark {
+    const char* name;
+    BenchFunction fn;
+};
+
+inline std::vector<MicroBenchmark>& microBenchmarks() {
+    static std::vector<MicroBenchmark> list;
+    return list;
+}
+
+inline bool registerMicroBenchmark(const char* name, BenchFunction fn) {
+    microBenchmarks().push_back({name, fn});
+    return true;
+}
+
+#define MICRO_BENCHMARK(fn) static const bool fn##_registered = registerMicroBenchmark(#fn, fn)
+
+// Run every registered benchmark whose name contains filter
+inline void runMicroBenchmarks(const std::string& filter, double minSeconds = 0.1) {
+    std::printf("%-32s %12s %14s\n", "benchmark", "ns/iter", "iterations");
+    for (const MicroBenchmark& b : microBenchmarks()) {
+        if (!filter.empty() && std::string(b.name).find(filter) == std::string::npos) continue;
+        uint64_t n = 1;
+        double seconds;
+        while (true) {
+            BenchState state(n);
+            b.fn(state);
+            seconds = state.seconds();
+            if (seconds >= minSeconds || n >= (uint64_t(1) << 40)) break;
+            double grow = seconds > 0 ? 1.4 * minSeconds / seconds : 100;
+            n = static_cast<uint64_t>(n * std::min(100.0, std::max(2.0, grow)));
+        }
+        std::printf("%-32s %12.2f %14llu\n", b.name, seconds * 1e9 / n, static_cast<unsigned long long>(n));
+    }
+}
@@ -1,9 +1,16 @@
 #pragma once
 
 #include "math.hpp"
+#include "mathf.hpp"
+#include "cluster_bvh.hpp"
 #include "texture.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 #include <vector>
 #include <string>
+#include <cstring>
+#include <charconv>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -21,12 +28,203 @@ struct Triangle {
     Triangle() : v0(0), v1(0), v2(0), n0(-1), n1(-1), n2(-1), t0(-1), t1(-1), t2(-1) {}
 };
 
+// Cursor over one line of a mapped OBJ file, following the whitespace and
+// number rules of the istream extraction used by Mesh::loadStream
+struct ObjLine {
+    const char* p;
+    const char* end;
+
+    ObjLine(const char* b, const char* e) : p(b), end(e) {}
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+    }
+
+    void skipSpace() {
+        while (p < end && isSpace(*p)) p++;
+    }
+
+    bool token(const char*& b, const char*& e) {
+        skipSpace();
+        b = p;
+        while (p < end && !isSpace(*p)) p++;
+        e = p;
+        return b != e;
+    }
+
+    bool number(double& out) {
+        skipSpace();
+        const char* s = p;
+        if (s < end && *s == '+' && s + 1 < end && s[1] != '-') s++;
+        auto r = std::from_chars(s, end, out);
+        if (r.ec != std::errc()) return false;
+        p = r.ptr;
+        return true;
+    }
+
+    static bool isToken(const char* b, const char* e, const char* word) {
+        size_t n = std::strlen(word);
+        return static_cast<size_t>(e - b) == n && std::memcmp(b, word, n) == 0;
+    }
+
+    // Leading integer of [b, e), like std::stoi on the same substring
+    static bool integer(const char* b, const char* e, int& out) {
+        if (b < e && *b == '+' && b + 1 < e && b[1] != '-') b++;
+        return std::from_chars(b, e, out).ec == std::errc();
+    }
+
+    // Face corner "v", "v/t", "v//n" or "v/t/n"; absent parts stay -1
+    static bool faceCorner(const char* b, const char* e, int& vi, int& ti, int& ni) {
+        vi = ti = ni = -1;
+        const char* slash1 = static_cast<const char*>(std::memchr(b, '/', e - b));
+        if (!slash1) return integer(b, e, vi);
+        if (!integer(b, slash1, vi)) return false;
+        const char* slash2 = static_cast<const char*>(std::memchr(slash1 + 1, '/', e - slash1 - 1));
+        if (!slash2) {
+            if (slash1 + 1 < e && !integer(slash1 + 1, e, ti)) return false;
+        } else {
+            if (slash1 + 1 < slash2 && !integer(slash1 + 1, slash2, ti)) return false;
+            if (slash2 + 1 < e && !integer(slash2 + 1, e, ni)) return false;
+        }
+        return true;
+    }
+};
+
+// Walk the OBJ records in [cur, end) and hand them to sink. Face corners are
+// passed as raw (vi, ti, ni) triples, absent parts being -1.
+template <class Sink>
+void parseObjLines(const char* cur, const char* end, Sink& sink) {
+    std::vector<int> corners;
+    while (cur < end) {
+        const char* nl = static_cast<const char*>(std::memchr(cur, '\n', end - cur));
+        const char* lineEnd = nl ? nl : end;
+        ObjLine line(cur, lineEnd);
+        cur = nl ? nl + 1 : end;
+        if (line.p == line.end || *line.p == '#') continue;
+
+        const char* pb;
+        const char* pe;
+        if (!line.token(pb, pe)) continue;
+
+        if (ObjLine::isToken(pb, pe, "v")) {
+            double x, y, z;
+            if (line.number(x) && line.number(y) && line.number(z))
+                sink.vertex(Vec3(x, y, z));
+        } else if (ObjLine::isToken(pb, pe, "vt")) {
+            double u, v;
+            if (line.number(u) && line.number(v))
+                sink.texCoord(Vec2(u, v));
+        } else if (ObjLine::isToken(pb, pe, "vn")) {
+            double x, y, z;
+            if (line.number(x) && line.number(y) && line.number(z))
+                sink.normal(Vec3(x, y, z).normalized());
+        } else if (ObjLine::isToken(pb, pe, "mtllib")) {
+            const char* mb;
+            const char* me;
+            if (line.token(mb, me)) sink.mtllib(std::string(mb, me));
+        } else if (ObjLine::isToken(pb, pe, "f")) {
+            corners.clear();
+            const char* tb;
+            const char* te;
+            bool ok = true;
+            while (ok && line.token(tb, te)) {
+                int vi, ti, ni;
+                ok = ObjLine::faceCorner(tb, te, vi, ti, ni);
+                corners.push_back(vi);
+                corners.push_back(ti);
+                corners.push_back(ni);
+            }
+            if (ok) sink.face(corners.data(), corners.size() / 3);
+        }
+    }
+}
+
+// Records of one newline-aligned slice of an OBJ file. Faces keep their raw
+// indices plus the chunk-local element counts seen so far, so relative
+// indices can be resolved once the counts of earlier chunks are known.
+struct ObjChunk {
+    struct Face {
+        size_t firstCorner, cornerCount;
+        int vertexCount, texCoordCount, normalCount;
+    };
+
+    std::vector<Vec3> vertices;
+    std::vector<Vec3> normals;
+    std::vector<Vec2> texCoords;
+    std::vector<int> corners;
+    std::vector<Face> faces;
+    std::vector<Triangle> triangles;
+    std::string mtlPath;
+
+    void vertex(const Vec3& v) { vertices.push_back(v); }
+    void texCoord(const Vec2& t) { texCoords.push_back(t); }
+    void normal(const Vec3& n) { normals.push_back(n); }
+    void mtllib(const std::string& name) { mtlPath = name; }
+
+    void face(const int* raw, size_t count) {
+        faces.push_back({corners.size() / 3, count, static_cast<int>(vertices.size()),
+                         static_cast<int>(texCoords.size()), static_cast<int>(normals.size())});
+        corners.insert(corners.end(), raw, raw + count * 3);
+    }
+};
+
 struct Mesh {
     std::vector<Vec3> vertices;
     std::vector<Vec3> normals;
     std::vector<Vec2> texCoords;
     std::vector<Triangle> triangles;
+    std::vector<Vec3> faceNormals;     // one per triangle, filled by computeFaceNormals
+    std::vector<Vec3f> floatVertices;  // single-precision copy for the renderer's vertex stage,
+    Vec3 floatOffset;                  // relative to this bounding-box center
+    ClusterBvh clusters;               // for frustum culling; orders triangles and vertices
     Texture texture;
+    // Files loadMaterial read or looked for, so caches can tell when the
+    // material or its texture changed
+    std::vector<std::string> materialFiles;
+
+    static Vec3 faceNormal(const Vec3& p0, const Vec3& p1, const Vec3& p2) {
+        return (p1 - p0).cross(p2 - p0).normalized();
+    }
+
+    void computeFaceNormals() {
+        faceNormals.resize(triangles.size());
+        for (size_t i = 0; i < triangles.size(); i++) {
+            const Triangle& t = triangles[i];
+            faceNormals[i] = faceNormal(vertices[t.v0], vertices[t.v1], vertices[t.v2]);
+        }
+    }
+
+    // Derived data the renderer uses; call after the geometry changes.
+    // Reorders triangles and vertices for the cluster hierarchy.
+    void computeRenderData(unsigned threads = 1) {
+        clusters.build(vertices, triangles, threads);
+        computeVertexData();
+    }
+
+    // Face normals and single-precision positions, for meshes already in
+    // cluster order (see ClusterBvh::assign). Positions are centered in
+    // double first, so models far from the origin keep their float precision.
+    void computeVertexData() {
+        computeFaceNormals();
+        Vec3 minV, maxV;
+        bounds(minV, maxV);
+        floatOffset = vertices.empty() ? Vec3(0, 0, 0) : (minV + maxV) * 0.5;
+        floatVertices.resize(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) floatVertices[i] = Vec3f(vertices[i] - floatOffset);
+    }
+
+    void bounds(Vec3& minV, Vec3& maxV) const {
+        minV = Vec3(1e30, 1e30, 1e30);
+        maxV = Vec3(-1e30, -1e30, -1e30);
+        for (const auto& v : vertices) {
+            minV.x = std::min(minV.x, v.x);
+            minV.y = std::min(minV.y, v.y);
+            minV.z = std::min(minV.z, v.z);
+            maxV.x = std::max(maxV.x, v.x);
+            maxV.y = std::max(maxV.y, v.y);
+            maxV.z = std::max(maxV.z, v.z);
+        }
+    }
 
     static std::string dirOf(const std::string& path) {
         size_t p = path.find_last_of("/\\");
@@ -56,16 +254,53 @@ struct Mesh {
         return !outMapKd.empty();
     }
 
-    bool load(const std::string& path) {
+    // Memory-mapped loader; produces the same mesh as loadStream. With
+    // threads > 1 large files are parsed in parallel chunks, giving results
+    // identical to the single-threaded path. Both finish with
+    // computeRenderData, so the mesh comes out in cluster order.
+    // minChunkBytes only needs changing to test chunk seams on small files.
+    bool load(const std::string& path, unsigned threads = 1, size_t minChunkBytes = MIN_CHUNK_BYTES) {
+        TraceScope trace("Mesh::load");
+        MappedFile file;
+        {
+            TraceScope trace("map file");
+            if (!file.open(path)) {
+                std::cerr << "Cannot open file: " << path << std::endl;
+                return false;
+            }
+        }
+
+        const char* data = file.data();
+        size_t size = file.size();
+        size_t chunks = std::min<size_t>(threads, size / std::max<size_t>(1, minChunkBytes));
+        std::string mtlPath;
+        if (chunks <= 1) {
+            TraceScope trace("parse");
+            Builder builder{*this, mtlPath, {}, {}, {}};
+            parseObjLines(data, data + size, builder);
+        } else {
+            loadChunks(data, size, chunks, mtlPath);
+        }
+
+        loadMaterial(path, mtlPath);
+        {
+            TraceScope trace("render data");
+            computeRenderData(threads);
+        }
+        return !vertices.empty() && !triangles.empty();
+    }
+
+    // Reference istringstream loader, kept for validating load(). The
+    // cluster order only depends on the parsed geometry, so equal parses
+    // give equal meshes.
+    bool loadStream(const std::string& path) {
         std::ifstream file(path);
         if (!file.is_open()) {
             std::cerr << "Cannot open file: " << path << std::endl;
             return false;
         }
 
-        std::string objDir = dirOf(path);
         std::string mtlPath;
-        std::string mapKdPath;
 
         std::string line;
         while (std::getline(file, line)) {
@@ -88,7 +323,9 @@ struct Mesh {
                 if (iss >> x >> y >> z)
                     normals.push_back(Vec3(x, y, z).normalized());
             } else if (prefix == "mtllib") {
-                iss >> mtlPath;
+                // A bare mtllib keeps the previous name, as in parseObjLines
+                std::string name;
+                if (iss >> name) mtlPath = name;
             } else if (prefix == "f") {
                 std::vector<int> vindices, tindices, nindices;
                 std::string token;
@@ -110,37 +347,161 @@ struct Mesh {
                                 ni = std::stoi(token.substr(slash2 + 1));
                         }
                     }
-                    vindices.push_back(vi > 0 ? vi - 1 : static_cast<int>(vertices.size()) + vi);
-                    if (ti > 0) tindices.push_back(ti - 1);
-                    else if (ti < 0 && !texCoords.empty()) tindices.push_back(static_cast<int>(texCoords.size()) + ti);
-                    if (ni > 0) nindices.push_back(ni - 1);
-                    else if (ni < 0 && !normals.empty()) nindices.push_back(static_cast<int>(normals.size()) + ni);
+                    addCorner(vi, ti, ni, vindices, tindices, nindices);
                 }
+                addFace(vindices, tindices, nindices, triangles);
+            }
+        }
 
-                for (size_t i = 1; i + 1 < vindices.size(); i++) {
-                    Triangle tri;
-                    tri.v0 = vindices[0];
-                    tri.v1 = vindices[i];
-                    tri.v2 = vindices[i + 1];
-                    tri.n0 = nindices.size() > 0 ? nindices[0] : -1;
-                    tri.n1 = nindices.size() > i ? nindices[i] : -1;
-                    tri.n2 = nindices.size() > i + 1 ? nindices[i + 1] : -1;
-                    tri.t0 = tindices.size() > 0 ? tindices[0] : -1;
-                    tri.t1 = tindices.size() > i ? tindices[i] : -1;
-                    tri.t2 = tindices.size() > i + 1 ? tindices[i + 1] : -1;
-                    triangles.push_back(tri);
-                }
+        loadMaterial(path, mtlPath);
+        computeRenderData();
+        return !vertices.empty() && !triangles.empty();
+    }
+
+    // Resolve 1-based / negative OBJ indices against the elements read so far
+    static void resolveCorner(int vi, int ti, int ni, int vertexCount, int texCoordCount, int normalCount,
+                              std::vector<int>& vindices, std::vector<int>& tindices, std::vector<int>& nindices) {
+        vindices.push_back(vi > 0 ? vi - 1 : vertexCount + vi);
+        if (ti > 0) tindices.push_back(ti - 1);
+        else if (ti < 0 && texCoordCount > 0) tindices.push_back(texCoordCount + ti);
+        if (ni > 0) nindices.push_back(ni - 1);
+        else if (ni < 0 && normalCount > 0) nindices.push_back(normalCount + ni);
+    }
+
+    void addCorner(int vi, int ti, int ni,
+                   std::vector<int>& vindices, std::vector<int>& tindices, std::vector<int>& nindices) const {
+        resolveCorner(vi, ti, ni, static_cast<int>(vertices.size()), static_cast<int>(texCoords.size()),
+                      static_cast<int>(normals.size()), vindices, tindices, nindices);
+    }
+
+    // Fan-triangulate one polygon
+    static void addFace(const std::vector<int>& vindices, const std::vector<int>& tindices,
+                        const std::vector<int>& nindices, std::vector<Triangle>& out) {
+        for (size_t i = 1; i + 1 < vindices.size(); i++) {
+            Triangle tri;
+            tri.v0 = vindices[0];
+            tri.v1 = vindices[i];
+            tri.v2 = vindices[i + 1];
+            tri.n0 = nindices.size() > 0 ? nindices[0] : -1;
+            tri.n1 = nindices.size() > i ? nindices[i] : -1;
+            tri.n2 = nindices.size() > i + 1 ? nindices[i + 1] : -1;
+            tri.t0 = tindices.size() > 0 ? tindices[0] : -1;
+            tri.t1 = tindices.size() > i ? tindices[i] : -1;
+            tri.t2 = tindices.size() > i + 1 ? tindices[i + 1] : -1;
+            out.push_back(tri);
+        }
+    }
+
+    // parseObjLines sink appending straight into the mesh
+    struct Builder {
+        Mesh& mesh;
+        std::string& mtlPath;
+        std::vector<int> vindices, tindices, nindices;
+
+        void vertex(const Vec3& v) { mesh.vertices.push_back(v); }
+        void texCoord(const Vec2& t) { mesh.texCoords.push_back(t); }
+        void normal(const Vec3& n) { mesh.normals.push_back(n); }
+        void mtllib(const std::string& name) { mtlPath = name; }
+
+        void face(const int* raw, size_t count) {
+            vindices.clear();
+            tindices.clear();
+            nindices.clear();
+            for (size_t i = 0; i < count; i++)
+                mesh.addCorner(raw[i * 3], raw[i * 3 + 1], raw[i * 3 + 2], vindices, tindices, nindices);
+            addFace(vindices, tindices, nindices, mesh.triangles);
+        }
+    };
+
+    static constexpr size_t MIN_CHUNK_BYTES = 1 << 20;
+
+    void loadChunks(const char* data, size_t size, size_t chunkCount, std::string& mtlPath) {
+        // Chunk i covers [bounds[i], bounds[i + 1]), each boundary just past a newline
+        std::vector<size_t> bounds(chunkCount + 1, size);
+        bounds[0] = 0;
+        for (size_t i = 1; i < chunkCount; i++) {
+            size_t pos = std::max(bounds[i - 1], size / chunkCount * i);
+            const void* nl = pos < size ? std::memchr(data + pos, '\n', size - pos) : nullptr;
+            bounds[i] = nl ? static_cast<const char*>(nl) - data + 1 : size;
+        }
+
+        std::vector<ObjChunk> chunks(chunkCount);
+        ThreadPool pool(static_cast<unsigned>(chunkCount));
+        pool.parallelFor(chunkCount, [&](size_t i) {
+            TraceScope trace("parse chunk");
+            parseObjLines(data + bounds[i], data + bounds[i + 1], chunks[i]);
+        });
+
+        // Element counts preceding each chunk
+        std::vector<int> vBase(chunkCount), tBase(chunkCount), nBase(chunkCount);
+        int v = static_cast<int>(vertices.size());
+        int t = static_cast<int>(texCoords.size());
+        int n = static_cast<int>(normals.size());
+        for (size_t i = 0; i < chunkCount; i++) {
+            vBase[i] = v;
+            tBase[i] = t;
+            nBase[i] = n;
+            v += static_cast<int>(chunks[i].vertices.size());
+            t += static_cast<int>(chunks[i].texCoords.size());
+            n += static_cast<int>(chunks[i].normals.size());
+            if (!chunks[i].mtlPath.empty()) mtlPath = chunks[i].mtlPath;
+        }
+
+        pool.parallelFor(chunkCount, [&](size_t i) {
+            TraceScope trace("resolve chunk");
+            ObjChunk& c = chunks[i];
+            std::vector<int> vindices, tindices, nindices;
+            for (const auto& f : c.faces) {
+                vindices.clear();
+                tindices.clear();
+                nindices.clear();
+                const int* raw = &c.corners[f.firstCorner * 3];
+                for (size_t k = 0; k < f.cornerCount; k++)
+                    resolveCorner(raw[k * 3], raw[k * 3 + 1], raw[k * 3 + 2], vBase[i] + f.vertexCount,
+                                  tBase[i] + f.texCoordCount, nBase[i] + f.normalCount,
+                                  vindices, tindices, nindices);
+                addFace(vindices, tindices, nindices, c.triangles);
             }
+        });
+
+        std::vector<size_t> triBase(chunkCount);
+        size_t triCount = 0;
+        for (size_t i = 0; i < chunkCount; i++) {
+            triBase[i] = triCount;
+            triCount += chunks[i].triangles.size();
         }
 
+        size_t tri0 = triangles.size();
+        vertices.resize(v);
+        texCoords.resize(t);
+        normals.resize(n);
+        triangles.resize(tri0 + triCount);
+        pool.parallelFor(chunkCount, [&](size_t i) {
+            TraceScope trace("copy chunk");
+            const ObjChunk& c = chunks[i];
+            std::copy(c.vertices.begin(), c.vertices.end(), vertices.begin() + vBase[i]);
+            std::copy(c.texCoords.begin(), c.texCoords.end(), texCoords.begin() + tBase[i]);
+            std::copy(c.normals.begin(), c.normals.end(), normals.begin() + nBase[i]);
+            std::copy(c.triangles.begin(), c.triangles.end(), triangles.begin() + tri0 + triBase[i]);
+        });
+    }
+
+    void loadMaterial(const std::string& path, std::string mtlPath) {
+        TraceScope trace("material");
+        std::string objDir = dirOf(path);
+        std::string mapKdPath;
+
         if (mtlPath.empty())
             mtlPath = baseName(path) + ".mtl";
 
         std::string fullMtl = objDir + mtlPath;
+        materialFiles.push_back(fullMtl);
         if (loadMtl(fullMtl, mapKdPath)) {
+            materialFiles.push_back(mapKdPath);
             if (!texture.load(mapKdPath)) {
                 size_t sep = mapKdPath.find_last_of("/\\");
                 std::string fname = sep == std::string::npos ? mapKdPath : mapKdPath.substr(sep + 1);
+                materialFiles.push_back(objDir + fname);
                 texture.load(objDir + fname);
             }
         }
@@ -151,7 +512,5 @@ struct Mesh {
         // if (texture.width > 0)
         //     std::cout << ", texture " << texture.width << "x" << texture.height;
         // std::cout << std::endl;
-
-        return !vertices.empty() && !triangles.empty();
     }
 };
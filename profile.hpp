@@ -0,0 +1,32 @@
+#pragma once
+
+#include <chrono>
+
+inline double nowSeconds() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Wall-clock seconds spent in each stage of one frame
+struct StageTimes {
+    double transform = 0, raster = 0, encode = 0, output = 0;
+
+    double total() const { return transform + raster + encode + output; }
+};
+
+// Stores how long the enclosing scope took into *slot. With a null slot the
+// clock is never read, so timers can stay in hot paths permanently.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(double* slot) : slot(slot), start(slot ? nowSeconds() : 0) {}
+    ~ScopedTimer() {
+        if (slot) *slot = nowSeconds() - start;
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    double* slot;
+    double start;
+};
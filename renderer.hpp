@@ -1,40 +1,258 @@
 #pragma once
 
 #include "math.hpp"
+#include "mathf.hpp"
 #include "obj_parser.hpp"
+#include "lod.hpp"
 #include "texture.hpp"
+#include "thread_pool.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
 #include <vector>
 #include <algorithm>
+#include <cstdint>
 #include <limits>
+#include <memory>
 
-// Screen pixel (RGB 0-1, depth; use intensity for grayscale when no texture)
-struct Pixel {
-    double r, g, b;
-    double intensity;
-    double depth;
-    bool hasColor;
+// 4-wide AVX row kernel, chosen at run time when the CPU supports it
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define RENDERER_AVX 1
+#define RENDERER_AVX_TARGET __attribute__((target("avx")))
+#elif defined(_MSC_VER) && defined(__AVX__)
+#define RENDERER_AVX 1
+#define RENDERER_AVX_TARGET
+#endif
+#ifdef RENDERER_AVX
+#include <immintrin.h>
+#endif
 
-    Pixel() : r(0), g(0), b(0), intensity(0), depth(std::numeric_limits<double>::max()), hasColor(false) {}
+// Rendered frame as separate planes: float depth, packed RGB8 color, 8-bit
+// intensity and one coverage bit per pixel. Only depth and coverage are
+// cleared; color and intensity are meaningful where the coverage bit is set.
+struct FrameBuffer {
+    int width = 0, height = 0;
+    int wordsPerRow = 0;             // coverage words per row, padded to 64-pixel boundaries
+    std::vector<float> depth;
+    std::vector<uint32_t> color;     // 0xRRGGBB, written when hasColor
+    std::vector<uint8_t> intensity;  // shade * 255
+    std::vector<uint64_t> coverage;
+    bool hasColor = false;           // frame was drawn with a texture
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        wordsPerRow = (w + 63) / 64;
+        depth.resize(w * h);
+        color.resize(w * h);
+        intensity.resize(w * h);
+        coverage.resize(static_cast<size_t>(wordsPerRow) * h);
+        clear();
+    }
+
+    void clear() {
+        std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::max());
+        std::fill(coverage.begin(), coverage.end(), 0);
+    }
+
+    bool covered(int x, int y) const {
+        return (coverage[y * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    // Set the coverage bit; true if it was clear
+    bool cover(int x, int y) {
+        uint64_t& word = coverage[y * wordsPerRow + (x >> 6)];
+        uint64_t bit = uint64_t(1) << (x & 63);
+        bool fresh = !(word & bit);
+        word |= bit;
+        return fresh;
+    }
+
+    static uint32_t packColor(double r, double g, double b) {
+        auto channel = [](double c) {
+            return static_cast<uint32_t>(std::min(255.0, std::max(0.0, c * 255.0 + 0.5)));
+        };
+        return channel(r) << 16 | channel(g) << 8 | channel(b);
+    }
+};
+
+// Per-block depth bounds over blocks of BLOCK x BLOCK pixels, used to skip
+// triangles or parts of them that are certainly hidden. minDepth is kept exact
+// as pixels are written; maxDepth stays at the clear value until every pixel
+// of the block is covered and is then recomputed lazily when dirty.
+struct CoarseDepth {
+    static constexpr int BLOCK = 8;
+
+    int blocksX = 0, blocksY = 0;
+    std::vector<float> minDepth, maxDepth;
+    std::vector<uint8_t> dirty;
+    std::vector<uint8_t> uncovered;  // pixels of the block not yet written this frame
+    std::vector<uint8_t> blockPixels;
+
+    void resize(int w, int h) {
+        blocksX = (w + BLOCK - 1) / BLOCK;
+        blocksY = (h + BLOCK - 1) / BLOCK;
+        minDepth.resize(blocksX * blocksY);
+        maxDepth.resize(blocksX * blocksY);
+        dirty.resize(blocksX * blocksY);
+        uncovered.resize(blocksX * blocksY);
+        blockPixels.resize(blocksX * blocksY);
+        for (int by = 0; by < blocksY; by++)
+            for (int bx = 0; bx < blocksX; bx++)
+                blockPixels[by * blocksX + bx] = static_cast<uint8_t>(
+                    (std::min(w, bx * BLOCK + BLOCK) - bx * BLOCK) * (std::min(h, by * BLOCK + BLOCK) - by * BLOCK));
+        clear();
+    }
+
+    void clear() {
+        std::fill(minDepth.begin(), minDepth.end(), std::numeric_limits<float>::max());
+        std::fill(maxDepth.begin(), maxDepth.end(), std::numeric_limits<float>::max());
+        std::fill(dirty.begin(), dirty.end(), 0);
+        std::copy(blockPixels.begin(), blockPixels.end(), uncovered.begin());
+    }
+
+    void written(int x, int y, float z, bool fresh) {
+        int b = (y / BLOCK) * blocksX + x / BLOCK;
+        minDepth[b] = std::min(minDepth[b], z);
+        if (fresh) uncovered[b]--;
+        dirty[b] = uncovered[b] == 0;
+    }
+};
+
+// Work done by the rasterizer, summed over a frame. A triangle drawn into
+// several tiles counts once per tile in the triangle and block counters.
+struct RasterStats {
+    uint64_t trianglesSubmitted = 0;
+    uint64_t trianglesCulled = 0;   // back-facing, degenerate, behind the camera or off screen
+    uint64_t trianglesClipped = 0;  // crossing the near plane or the guard band
+    uint64_t clustersCulled = 0;    // outside the view frustum or facing away, their triangles counted as culled
+    uint64_t trianglesTested = 0;   // drawTriangle calls with a non-empty rectangle
+    uint64_t trianglesRejected = 0; // ... of which every block was occluded
+    uint64_t trianglesSmall = 0;    // ... drawn by testing their few pixel centers directly
+    uint64_t blocksTested = 0;
+    uint64_t blocksRejected = 0;    // occluded by the coarse depth, skipped
+    uint64_t blocksAccepted = 0;    // entirely in front, drawn without depth reads
+    uint64_t pixelsTested = 0;      // pixel centers inside a triangle, outside rejected blocks
+    uint64_t pixelsShaded = 0;      // ... that passed the depth test
+
+    void add(const RasterStats& o) {
+        trianglesSubmitted += o.trianglesSubmitted;
+        trianglesCulled += o.trianglesCulled;
+        trianglesClipped += o.trianglesClipped;
+        clustersCulled += o.clustersCulled;
+        trianglesTested += o.trianglesTested;
+        trianglesRejected += o.trianglesRejected;
+        trianglesSmall += o.trianglesSmall;
+        blocksTested += o.blocksTested;
+        blocksRejected += o.blocksRejected;
+        blocksAccepted += o.blocksAccepted;
+        pixelsTested += o.pixelsTested;
+        pixelsShaded += o.pixelsShaded;
+    }
+};
+
+// Projected triangle ready for scan conversion. Edge i (opposite vertex i) is
+// e_i(X, Y) = edgeA[i] * X + edgeB[i] * Y + edgeC[i] over fixed-point screen
+// coordinates; all values are integers held exactly in doubles.
+struct ScreenTriangle {
+    Vec3 p0, p1, p2;  // NDC
+    double u0, v0, u1, v1, u2, v2;
+    double shade;
+    int minX, minY, maxX, maxY;  // pixels whose centers lie in the triangle's box, clamped to the viewport
+    double edgeA[3], edgeB[3], edgeC[3];
+    double edgeMin[3];  // 0 on top-left edges, 1 elsewhere, so shared edges are drawn once
+    double invArea;
+    double minZ, maxZ;
+};
+
+// Clip-space vertex with the attributes that are interpolated along clipped
+// edges
+struct ClipVertex {
+    Vec4 pos;
+    double u, v;
 };
 
 class Renderer {
 public:
+    // Screen tiles rasterized independently by the threaded path
+    static constexpr int TILE_W = 64;
+    static constexpr int TILE_H = 8;
+    // Triangles per geometry-pass job and vertices per vertex-stage job
+    static constexpr size_t GEOMETRY_BATCH = 2048;
+    static constexpr size_t VERTEX_BATCH = 16384;
+    // Fractional bits of snapped screen coordinates
+    static constexpr int SUBPIXEL_BITS = 8;
+    // Triangles reaching further than this many pixels off-screen are clipped,
+    // which keeps every edge function value below 2^53
+    static constexpr double GUARD_BAND = 1 << 14;
+    // Most screen triangles one mesh triangle can turn into: clipping against
+    // the near plane and four guard-band sides leaves at most 8 vertices
+    static constexpr int MAX_CLIP_VERTICES = 8;
+    static constexpr int MAX_CLIPPED = MAX_CLIP_VERTICES - 2;
+    // Triangles whose box spans at most this many pixels each way skip the
+    // coarse-depth blocks and the stepped scan (see drawSmall)
+    static constexpr int SMALL_TRIANGLE = 2;
+
+    // Whole coverage words and coarse-depth blocks per tile, so tiles never
+    // write the same word or block
+    static_assert(TILE_W % 64 == 0, "tiles must span whole coverage words");
+    static_assert(TILE_W % CoarseDepth::BLOCK == 0 && TILE_H % CoarseDepth::BLOCK == 0,
+                  "tiles must span whole coarse-depth blocks");
+
     int width, height;
-    std::vector<Pixel> framebuffer;
-    std::vector<double> zBuffer;
+    FrameBuffer frame;
+    CoarseDepth coarse;
+    RasterStats stats;  // reset by render()
+    StageTimes times;   // transform and raster, filled in when profiling
+    size_t lodLevel = 0;  // level drawn by the last render(const LodChain&)
     
     Vec3 lightDir;
     Mat4 viewProj;
     
     Renderer(int w, int h) : width(w), height(h) {
-        framebuffer.resize(w * h);
-        zBuffer.resize(w * h, std::numeric_limits<double>::max());
+        frame.resize(w, h);
+        coarse.resize(w, h);
         lightDir = Vec3(0.5, 0.5, 1.0).normalized();
+        tilesX = (w + TILE_W - 1) / TILE_W;
+        tilesY = (h + TILE_H - 1) / TILE_H;
+    }
+
+    // threads > 1 switches render() to the binned tile rasterizer, which
+    // produces the same image as the serial path
+    void setThreads(unsigned threads) {
+        if (threads > 1) pool.reset(new ThreadPool(threads));
+        else pool.reset();
+    }
+
+    // Use the AVX row kernel if the CPU has it (the default); the image is
+    // identical either way
+    void setSimd(bool enable) { simd = enable && cpuHasAvx(); }
+    bool simdEnabled() const { return simd; }
+
+    // Skip blocks hidden according to the coarse depth (the default); the
+    // image is identical either way
+    void setCoarseDepth(bool enable) { useCoarse = enable; }
+
+    // Draw triangles covering at most SMALL_TRIANGLE x SMALL_TRIANGLE pixels
+    // with drawSmall (the default); the image is identical either way
+    void setSmallTriangles(bool enable) { useSmall = enable; }
+
+    // Record transform and raster times into `times` (counters in `stats`
+    // are always kept)
+    void setProfiling(bool enable) { profiling = enable; }
+
+    static bool cpuHasAvx() {
+#if defined(RENDERER_AVX) && defined(_MSC_VER)
+        return true;
+#elif defined(RENDERER_AVX)
+        return __builtin_cpu_supports("avx");
+#else
+        return false;
+#endif
     }
     
     void clear() {
-        std::fill(framebuffer.begin(), framebuffer.end(), Pixel());
-        std::fill(zBuffer.begin(), zBuffer.end(), std::numeric_limits<double>::max());
+        frame.clear();
+        coarse.clear();
     }
     
     // Convert NDC (-1,1) to screen coordinates
@@ -60,89 +278,642 @@ public:
         return w0 >= 0 && w1 >= 0 && w2 >= 0;
     }
     
-    void rasterizeTriangle(const Vec3& p0, const Vec3& p1, const Vec3& p2,
-                           const Vec3& n0, const Vec3& n1, const Vec3& n2,
-                           double u0, double v0, double u1, double v1, double u2, double v2,
-                           const Texture* tex) {
-        // Project to NDC
-        Vec3 sp0 = viewProj.transformPoint(p0);
-        Vec3 sp1 = viewProj.transformPoint(p1);
-        Vec3 sp2 = viewProj.transformPoint(p2);
-        
-        // Back-face culling (check cross product in NDC)
-        double cross = (sp1.x - sp0.x) * (sp2.y - sp0.y) - (sp2.x - sp0.x) * (sp1.y - sp0.y);
-        if (cross <= 0) return;
-        
-        // Compute normal (for lighting)
-        Vec3 faceNormal = (p1 - p0).cross(p2 - p0).normalized();
+    // Project, cull and shade one triangle; false if nothing can be drawn
+    // Takes NDC positions and the model-space face normal
+    bool setupTriangle(const Vec3& sp0, const Vec3& sp1, const Vec3& sp2, const Vec3& faceNormal,
+                       double u0, double v0, double u1, double v1, double u2, double v2,
+                       ScreenTriangle& st) const {
+        // Snap to the fixed-point screen grid (y down)
+        const double scale = 1 << SUBPIXEL_BITS;
+        const double limit = GUARD_BAND * scale;
+        double x[3], y[3];
+        const Vec3* sp[3] = {&sp0, &sp1, &sp2};
+        for (int i = 0; i < 3; i++) {
+            x[i] = std::floor((sp[i]->x + 1.0) * 0.5 * width * scale + 0.5);
+            y[i] = std::floor((1.0 - sp[i]->y) * 0.5 * height * scale + 0.5);
+            // Only reached by unclipped input (or NaNs); clipTriangle keeps
+            // vertices well inside
+            if (!(std::abs(x[i]) <= limit && std::abs(y[i]) <= limit)) return false;
+        }
+
+        // Back-face culling (counter-clockwise in NDC is front-facing)
+        double area = (x[2] - x[0]) * (y[1] - y[0]) - (x[1] - x[0]) * (y[2] - y[0]);
+        if (area <= 0) return false;
+
+        // Pixels (x, y) are sampled at ((x + 0.5) * scale, (y + 0.5) * scale)
+        double half = scale * 0.5;
+        st.minX = std::max(0, static_cast<int>(std::ceil((std::min({x[0], x[1], x[2]}) - half) / scale)));
+        st.maxX = std::min(width - 1, static_cast<int>(std::floor((std::max({x[0], x[1], x[2]}) - half) / scale)));
+        st.minY = std::max(0, static_cast<int>(std::ceil((std::min({y[0], y[1], y[2]}) - half) / scale)));
+        st.maxY = std::min(height - 1, static_cast<int>(std::floor((std::max({y[0], y[1], y[2]}) - half) / scale)));
+        if (st.minX > st.maxX || st.minY > st.maxY) return false;
+
+        for (int i = 0; i < 3; i++) {
+            int a = (i + 1) % 3, b = (i + 2) % 3;
+            double dx = x[b] - x[a], dy = y[b] - y[a];
+            st.edgeA[i] = dy;
+            st.edgeB[i] = -dx;
+            st.edgeC[i] = dx * y[a] - dy * x[a];
+            bool topLeft = dy > 0 || (dy == 0 && dx < 0);
+            st.edgeMin[i] = topLeft ? 0 : 1;
+        }
+        st.invArea = 1.0 / area;
+        st.minZ = std::min({sp0.z, sp1.z, sp2.z});
+        st.maxZ = std::max({sp0.z, sp1.z, sp2.z});
+
         double shade = std::max(0.0, faceNormal.dot(lightDir));
-        shade = 0.3 + 0.7 * shade;  // ambient + diffuse
-        
-        // Screen space bounding box (NDC [-1,1] -> screen)
-        int minX = std::max(0, static_cast<int>(std::floor((std::min({sp0.x, sp1.x, sp2.x}) + 1.0) * 0.5 * width)));
-        int maxX = std::min(width - 1, static_cast<int>(std::ceil((std::max({sp0.x, sp1.x, sp2.x}) + 1.0) * 0.5 * width)));
-        int minY = std::max(0, static_cast<int>(std::floor((1.0 - std::max({sp0.y, sp1.y, sp2.y})) * 0.5 * height)));
-        int maxY = std::min(height - 1, static_cast<int>(std::ceil((1.0 - std::min({sp0.y, sp1.y, sp2.y})) * 0.5 * height)));
-        
+        st.shade = 0.3 + 0.7 * shade;  // ambient + diffuse
+
+        st.p0 = sp0; st.p1 = sp1; st.p2 = sp2;
+        st.u0 = u0; st.v0 = v0; st.u1 = u1; st.v1 = v1; st.u2 = u2; st.v2 = v2;
+        return true;
+    }
+
+    // Scan-convert the part of st inside the inclusive rectangle [x0,x1]x[y0,y1],
+    // one coarse-depth block at a time
+    void drawTriangle(const ScreenTriangle& st, const Texture* tex, int x0, int y0, int x1, int y1,
+                      RasterStats& counters) {
+        int minX = std::max(st.minX, x0), maxX = std::min(st.maxX, x1);
+        int minY = std::max(st.minY, y0), maxY = std::min(st.maxY, y1);
+        if (minX > maxX || minY > maxY) return;
+        counters.trianglesTested++;
+        if (useSmall && maxX - minX < SMALL_TRIANGLE && maxY - minY < SMALL_TRIANGLE) {
+            counters.trianglesSmall++;
+            drawSmall(st, tex, minX, minY, maxX, maxY, counters);
+            return;
+        }
+        if (!useCoarse) {
+            drawRect(st, tex, minX, minY, maxX, maxY, false, counters);
+            return;
+        }
+
+        // Interpolated depths stay within [minZ, maxZ] up to rounding far
+        // below the margin, so these bounds are safe after the float cast
+        double margin = 1e-9 * (1.0 + std::max(std::abs(st.minZ), std::abs(st.maxZ)));
+        float nearest = static_cast<float>(st.minZ - margin);
+        float farthest = static_cast<float>(st.maxZ + margin);
+
+        const int B = CoarseDepth::BLOCK;
+        bool drawn = false;
+        for (int by = minY / B; by <= maxY / B; by++) {
+            for (int bx = minX / B; bx <= maxX / B; bx++) {
+                counters.blocksTested++;
+                if (nearest >= blockMaxDepth(bx, by)) {
+                    counters.blocksRejected++;
+                    continue;
+                }
+                bool inFront = farthest < coarse.minDepth[by * coarse.blocksX + bx];
+                if (inFront) counters.blocksAccepted++;
+                drawRect(st, tex, std::max(minX, bx * B), std::max(minY, by * B),
+                         std::min(maxX, bx * B + B - 1), std::min(maxY, by * B + B - 1), inFront, counters);
+                drawn = true;
+            }
+        }
+        if (!drawn) counters.trianglesRejected++;
+    }
+
+    float blockMaxDepth(int bx, int by) {
+        int b = by * coarse.blocksX + bx;
+        if (coarse.dirty[b]) {
+            const int B = CoarseDepth::BLOCK;
+            float m = 0;
+            for (int y = by * B; y < std::min(height, by * B + B); y++)
+                for (int x = bx * B; x < std::min(width, bx * B + B); x++)
+                    m = std::max(m, frame.depth[y * width + x]);
+            coarse.maxDepth[b] = m;
+            coarse.dirty[b] = 0;
+        }
+        return coarse.maxDepth[b];
+    }
+
+    // Scan-convert st over an inclusive rectangle already clipped to its box.
+    // Edge values are evaluated once at the first pixel and then stepped.
+    // inFront skips the depth reads when the whole rectangle is known to pass.
+    void drawRect(const ScreenTriangle& st, const Texture* tex, int minX, int minY, int maxX, int maxY,
+                  bool inFront, RasterStats& counters) {
+        const double scale = 1 << SUBPIXEL_BITS;
+        double sx = (minX + 0.5) * scale, sy = (minY + 0.5) * scale;
+        double row[3], stepX[3], stepY[3];
+        for (int i = 0; i < 3; i++) {
+            row[i] = st.edgeA[i] * sx + st.edgeB[i] * sy + st.edgeC[i];
+            stepX[i] = st.edgeA[i] * scale;
+            stepY[i] = st.edgeB[i] * scale;
+        }
+        bool textured = tex && tex->width > 0;
+        uint64_t tested = 0, shaded = 0;
+
         for (int y = minY; y <= maxY; y++) {
-            for (int x = minX; x <= maxX; x++) {
-                double px = (x + 0.5) / width * 2.0 - 1.0;
-                double py = 1.0 - (y + 0.5) / height * 2.0;
-                
-                double w0, w1, w2;
-                if (!insideTriangle(px, py, sp0.x, sp0.y, sp1.x, sp1.y, sp2.x, sp2.y, w0, w1, w2))
+#ifdef RENDERER_AVX
+            // Narrow spans (most triangles at terminal resolution) stay scalar
+            if (simd && maxX - minX >= 3) {
+                drawRowAvx(st, tex, textured, y, minX, maxX, row, stepX, inFront, tested, shaded);
+                for (int i = 0; i < 3; i++) row[i] += stepY[i];
+                continue;
+            }
+#endif
+            double e0 = row[0], e1 = row[1], e2 = row[2];
+            for (int x = minX; x <= maxX; x++, e0 += stepX[0], e1 += stepX[1], e2 += stepX[2]) {
+                if (e0 < st.edgeMin[0] || e1 < st.edgeMin[1] || e2 < st.edgeMin[2])
                     continue;
-                
-                double z = w0 * sp0.z + w1 * sp1.z + w2 * sp2.z;
+
+                tested++;
+                double w0 = e0 * st.invArea, w1 = e1 * st.invArea, w2 = e2 * st.invArea;
+                float z = static_cast<float>(w0 * st.p0.z + w1 * st.p1.z + w2 * st.p2.z);
                 int idx = y * width + x;
-                if (z < zBuffer[idx]) {
-                    zBuffer[idx] = z;
-                    framebuffer[idx].depth = z;
-                    framebuffer[idx].intensity = shade;
-                    if (tex && tex->width > 0) {
-                        double u = w0 * u0 + w1 * u1 + w2 * u2;
-                        double v = w0 * v0 + w1 * v1 + w2 * v2;
-                        tex->sample(u, v, framebuffer[idx].r, framebuffer[idx].g, framebuffer[idx].b);
-                        framebuffer[idx].r *= shade;
-                        framebuffer[idx].g *= shade;
-                        framebuffer[idx].b *= shade;
-                        framebuffer[idx].hasColor = true;
-                    } else {
-                        framebuffer[idx].hasColor = false;
-                    }
+                if (inFront || z < frame.depth[idx]) {
+                    shadePixel(st, tex, textured, x, y, w0, w1, w2, z);
+                    shaded++;
                 }
             }
+            for (int i = 0; i < 3; i++) row[i] += stepY[i];
         }
+        counters.pixelsTested += tested;
+        counters.pixelsShaded += shaded;
+    }
+
+    // Dense meshes at terminal resolution are mostly triangles with one to
+    // four candidate pixels; evaluating the edge functions at each center is
+    // cheaper than the block and stepping setup. Covered pixels already
+    // nearer than the whole triangle are skipped before interpolating,
+    // standing in for the coarse depth test. Edge values are exact integers
+    // either way, so the pixels match drawRect's.
+    void drawSmall(const ScreenTriangle& st, const Texture* tex, int minX, int minY, int maxX, int maxY,
+                   RasterStats& counters) {
+        const double scale = 1 << SUBPIXEL_BITS;
+        bool textured = tex && tex->width > 0;
+        double margin = 1e-9 * (1.0 + std::max(std::abs(st.minZ), std::abs(st.maxZ)));
+        float nearest = static_cast<float>(st.minZ - margin);
+        for (int y = minY; y <= maxY; y++) {
+            double sy = (y + 0.5) * scale;
+            for (int x = minX; x <= maxX; x++) {
+                double sx = (x + 0.5) * scale;
+                double e0 = st.edgeA[0] * sx + st.edgeB[0] * sy + st.edgeC[0];
+                double e1 = st.edgeA[1] * sx + st.edgeB[1] * sy + st.edgeC[1];
+                double e2 = st.edgeA[2] * sx + st.edgeB[2] * sy + st.edgeC[2];
+                if (e0 < st.edgeMin[0] || e1 < st.edgeMin[1] || e2 < st.edgeMin[2]) continue;
+
+                // Counted like drawRect's pixels, before the early depth out
+                counters.pixelsTested++;
+                if (nearest >= frame.depth[y * width + x]) continue;
+                double w0 = e0 * st.invArea, w1 = e1 * st.invArea, w2 = e2 * st.invArea;
+                float z = static_cast<float>(w0 * st.p0.z + w1 * st.p1.z + w2 * st.p2.z);
+                if (z < frame.depth[y * width + x]) {
+                    shadePixel(st, tex, textured, x, y, w0, w1, w2, z);
+                    counters.pixelsShaded++;
+                }
+            }
+        }
+    }
+
+    // Write a pixel that passed the depth test
+    void shadePixel(const ScreenTriangle& st, const Texture* tex, bool textured, int x, int y,
+                    double w0, double w1, double w2, float z) {
+        int idx = y * width + x;
+        double shade = st.shade;
+        frame.depth[idx] = z;
+        frame.intensity[idx] = static_cast<uint8_t>(shade * 255.0 + 0.5);
+        coarse.written(x, y, z, frame.cover(x, y));
+        if (textured) {
+            double u = w0 * st.u0 + w1 * st.u1 + w2 * st.u2;
+            double v = w0 * st.v0 + w1 * st.v1 + w2 * st.v2;
+            double r, g, b;
+            tex->sample(u, v, r, g, b);
+            frame.color[idx] = FrameBuffer::packColor(r * shade, g * shade, b * shade);
+        }
+    }
+
+#ifdef RENDERER_AVX
+    // Four pixels per step: coverage, depth interpolation and depth test in
+    // vector registers, shading per surviving pixel. Edge values are exact and
+    // the depth arithmetic mirrors the scalar loop, so results are identical.
+    RENDERER_AVX_TARGET
+    void drawRowAvx(const ScreenTriangle& st, const Texture* tex, bool textured, int y, int minX, int maxX,
+                    const double row[3], const double stepX[3], bool inFront, uint64_t& tested, uint64_t& shaded) {
+        static const uint8_t bitCount[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+        const __m256d lane = _mm256_set_pd(3, 2, 1, 0);
+        __m256d e[3], step4[3], edgeMin[3];
+        for (int i = 0; i < 3; i++) {
+            e[i] = _mm256_add_pd(_mm256_set1_pd(row[i]), _mm256_mul_pd(lane, _mm256_set1_pd(stepX[i])));
+            step4[i] = _mm256_set1_pd(stepX[i] * 4);
+            edgeMin[i] = _mm256_set1_pd(st.edgeMin[i]);
+        }
+        const __m256d invArea = _mm256_set1_pd(st.invArea);
+        const __m256d z0 = _mm256_set1_pd(st.p0.z), z1 = _mm256_set1_pd(st.p1.z), z2 = _mm256_set1_pd(st.p2.z);
+        alignas(32) double w0[4], w1[4], w2[4];
+        alignas(16) float z[4];
+
+        for (int x = minX; x <= maxX; x += 4) {
+            __m256d inside = _mm256_and_pd(
+                _mm256_and_pd(_mm256_cmp_pd(e[0], edgeMin[0], _CMP_GE_OQ), _mm256_cmp_pd(e[1], edgeMin[1], _CMP_GE_OQ)),
+                _mm256_cmp_pd(e[2], edgeMin[2], _CMP_GE_OQ));
+            int mask = _mm256_movemask_pd(inside);
+            int remaining = maxX - x + 1;
+            if (remaining < 4) mask &= (1 << remaining) - 1;
+
+            if (mask) {
+                tested += bitCount[mask];
+                __m256d vw0 = _mm256_mul_pd(e[0], invArea);
+                __m256d vw1 = _mm256_mul_pd(e[1], invArea);
+                __m256d vw2 = _mm256_mul_pd(e[2], invArea);
+                __m128 vz = _mm256_cvtpd_ps(_mm256_add_pd(
+                    _mm256_add_pd(_mm256_mul_pd(vw0, z0), _mm256_mul_pd(vw1, z1)), _mm256_mul_pd(vw2, z2)));
+                if (!inFront) {
+                    const __m128i loadMask = _mm_castps_si128(_mm_cmplt_ps(
+                        _mm_set_ps(3, 2, 1, 0), _mm_set1_ps(static_cast<float>(std::min(remaining, 4)))));
+                    __m128 depth = _mm_maskload_ps(&frame.depth[y * width + x], loadMask);
+                    mask &= _mm_movemask_ps(_mm_cmplt_ps(vz, depth));
+                }
+                if (mask) {
+                    shaded += bitCount[mask];
+                    _mm256_store_pd(w0, vw0);
+                    _mm256_store_pd(w1, vw1);
+                    _mm256_store_pd(w2, vw2);
+                    _mm_store_ps(z, vz);
+                    for (int k = 0; k < 4; k++)
+                        if (mask & (1 << k))
+                            shadePixel(st, tex, textured, x + k, y, w0[k], w1[k], w2[k], z[k]);
+                }
+            }
+            for (int i = 0; i < 3; i++) e[i] = _mm256_add_pd(e[i], step4[i]);
+        }
+    }
+#endif
+
+    // Uses the positions from transformVertices and the face normals picked
+    // by rasterize.
+    // Returns how many screen triangles were written to out (0 if culled);
+    // more than one only when the triangle had to be clipped, which *clipped
+    // reports.
+    int setupMeshTriangle(const Mesh& mesh, size_t index, ScreenTriangle* out, bool& clipped) const {
+        const Triangle& tri = mesh.triangles[index];
+        const Vec4f& c0 = clip[tri.v0];
+        const Vec4f& c1 = clip[tri.v1];
+        const Vec4f& c2 = clip[tri.v2];
+        unsigned code0 = outcode(c0.x, c0.y, c0.z, c0.w), code1 = outcode(c1.x, c1.y, c1.z, c1.w),
+                 code2 = outcode(c2.x, c2.y, c2.z, c2.w);
+        clipped = false;
+        if (code0 & code1 & code2) return 0;
+
+        double u0 = 0, v0 = 0, u1 = 0, v1 = 0, u2 = 0, v2 = 0;
+        if (tri.t0 >= 0 && tri.t1 >= 0 && tri.t2 >= 0 && tri.t0 < (int)mesh.texCoords.size() &&
+            tri.t1 < (int)mesh.texCoords.size() && tri.t2 < (int)mesh.texCoords.size()) {
+            u0 = mesh.texCoords[tri.t0].u; v0 = mesh.texCoords[tri.t0].v;
+            u1 = mesh.texCoords[tri.t1].u; v1 = mesh.texCoords[tri.t1].v;
+            u2 = mesh.texCoords[tri.t2].u; v2 = mesh.texCoords[tri.t2].v;
+        }
+        const Vec3& faceNormal = faceNormals[index];
+        // Both paths divide in double, so a vertex shared by a clipped and
+        // an unclipped triangle snaps to the same subpixel position
+        ClipVertex v[3] = {{Vec4(c0.x, c0.y, c0.z, c0.w), u0, v0},
+                           {Vec4(c1.x, c1.y, c1.z, c1.w), u1, v1},
+                           {Vec4(c2.x, c2.y, c2.z, c2.w), u2, v2}};
+        unsigned any = code0 | code1 | code2;
+        if (!(any & CLIP_PLANES))
+            return setupTriangle(v[0].pos.project(), v[1].pos.project(), v[2].pos.project(), faceNormal,
+                                 u0, v0, u1, v1, u2, v2, out[0]);
+        clipped = true;
+        return clipTriangle(v, any, faceNormal, out);
+    }
+
+    // Outcode bits: the planes clipTriangle clips against (near, then the
+    // guard-band sides) and the viewport sides, used only to reject
+    // triangles wholly outside one of them
+    enum : unsigned {
+        CLIP_NEAR = 1u << 0,
+        CLIP_GUARD_LEFT = 1u << 1,
+        CLIP_GUARD_RIGHT = 1u << 2,
+        CLIP_GUARD_BOTTOM = 1u << 3,
+        CLIP_GUARD_TOP = 1u << 4,
+        CLIP_PLANES = (1u << 5) - 1,
+        OUT_LEFT = 1u << 5,
+        OUT_RIGHT = 1u << 6,
+        OUT_BOTTOM = 1u << 7,
+        OUT_TOP = 1u << 8,
+    };
+
+    // Guard band in NDC units: projected vertices within +-guardX, +-guardY
+    // stay inside GUARD_BAND pixels
+    double guardX() const { return GUARD_BAND / width; }
+    double guardY() const { return GUARD_BAND / height; }
+
+    // Planes a clip-space point lies outside of. Everything behind the
+    // camera is outside the near plane (z >= -w).
+    template <typename T>
+    unsigned outcode(T x, T y, T z, T w) const {
+        const T gx = static_cast<T>(guardX()), gy = static_cast<T>(guardY());
+        unsigned code = 0;
+        if (z < -w) code |= CLIP_NEAR;
+        if (x < -gx * w) code |= CLIP_GUARD_LEFT;
+        if (x > gx * w) code |= CLIP_GUARD_RIGHT;
+        if (y < -gy * w) code |= CLIP_GUARD_BOTTOM;
+        if (y > gy * w) code |= CLIP_GUARD_TOP;
+        if (x < -w) code |= OUT_LEFT;
+        if (x > w) code |= OUT_RIGHT;
+        if (y < -w) code |= OUT_BOTTOM;
+        if (y > w) code |= OUT_TOP;
+        return code;
+    }
+
+    // Sutherland-Hodgman in homogeneous clip space against the planes set in
+    // planes, then set up the fan of the remaining polygon. Clipping keeps
+    // the winding, so back faces are still culled per fan triangle.
+    int clipTriangle(const ClipVertex tri[3], unsigned planes, const Vec3& faceNormal, ScreenTriangle* out) const {
+        ClipVertex buffer[2][MAX_CLIP_VERTICES];
+        const ClipVertex* poly = tri;
+        int n = 3;
+        const double gx = guardX(), gy = guardY();
+        for (int plane = 0; plane < 5; plane++) {
+            if (!(planes & (1u << plane))) continue;
+            auto distance = [&](const Vec4& p) {
+                switch (plane) {
+                case 0: return p.z + p.w;
+                case 1: return gx * p.w + p.x;
+                case 2: return gx * p.w - p.x;
+                case 3: return gy * p.w + p.y;
+                default: return gy * p.w - p.y;
+                }
+            };
+            ClipVertex* next = buffer[plane & 1];
+            int m = 0;
+            for (int i = 0; i < n; i++) {
+                const ClipVertex& a = poly[i];
+                const ClipVertex& b = poly[(i + 1) % n];
+                double da = distance(a.pos), db = distance(b.pos);
+                if (da >= 0) next[m++] = a;
+                if ((da >= 0) != (db >= 0)) {
+                    // Interpolate from the inside end, so neighbours sharing
+                    // the edge get the very same point
+                    next[m++] = da >= 0 ? lerpClip(a, b, da / (da - db)) : lerpClip(b, a, db / (db - da));
+                }
+            }
+            poly = next;
+            n = m;
+            if (n < 3) return 0;
+        }
+
+        int count = 0;
+        Vec3 p0 = poly[0].pos.project();
+        for (int i = 1; i + 1 < n; i++) {
+            if (setupTriangle(p0, poly[i].pos.project(), poly[i + 1].pos.project(), faceNormal,
+                              poly[0].u, poly[0].v, poly[i].u, poly[i].v, poly[i + 1].u, poly[i + 1].v,
+                              out[count]))
+                count++;
+        }
+        return count;
+    }
+
+    static ClipVertex lerpClip(const ClipVertex& a, const ClipVertex& b, double t) {
+        return {Vec4(a.pos.x + (b.pos.x - a.pos.x) * t, a.pos.y + (b.pos.y - a.pos.y) * t,
+                     a.pos.z + (b.pos.z - a.pos.z) * t, a.pos.w + (b.pos.w - a.pos.w) * t),
+                a.u + (b.u - a.u) * t, a.v + (b.v - a.v) * t};
     }
     
-    void render(const Mesh& mesh) {
+    void render(const Mesh& mesh) { render(mesh, mesh.texture); }
+
+    // Draw mesh with another mesh's texture, as for simplified levels
+    void render(const Mesh& mesh, const Texture& texture) {
+        transformVertices(mesh);
+        rasterize(mesh, texture);
+    }
+
+    // Draw the coarsest level of lods whose estimated error stays below half
+    // a pixel from the current viewProj (see LodChain::select), recording it
+    // in lodLevel
+    void render(const LodChain& lods) {
+        lodLevel = lods.select(viewProj, width, height);
+        render(lods.level(lodLevel), lods.texture());
+    }
+
+    // Vertex stage: find the mesh clusters inside the view frustum and
+    // facing the camera, then transform the vertices they use once into
+    // clip space (`clip`), leaving the divide to triangle setup. Runs in
+    // single precision; setup goes back to double for exact edge functions.
+    void transformVertices(const Mesh& mesh) {
+        ScopedTimer timer(profiling ? &times.transform : nullptr);
+        TraceScope trace("transform");
+        findVisible(mesh);
+        const size_t count = mesh.vertices.size();
+        clip.resize(count);
+        // Float positions are relative to floatOffset; adding it back in
+        // double keeps the large translation out of the float math
+        const Mat4f mvp(viewProj * Mat4::translate(mesh.floatOffset));
+        const bool haveFloat = mesh.floatVertices.size() == count;
+        auto position = [&](size_t i) {
+            return haveFloat ? mesh.floatVertices[i] : Vec3f(mesh.vertices[i] - mesh.floatOffset);
+        };
+        auto run = [&](size_t begin, size_t end) {
+            if (haveFloat) {
+                mvp.transformPoints(&mesh.floatVertices[begin], &clip[begin], end - begin);
+                return;
+            }
+            for (size_t i = begin; i < end; i++) clip[i] = mvp.transformClip(position(i));
+        };
+        auto gather = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) clip[visibleShared[i]] = mvp.transformClip(position(visibleShared[i]));
+        };
+        size_t visible = visibleShared.size();
+        for (const auto& r : visibleVertices) visible += r.second - r.first;
+        if (!pool || visible < VERTEX_BATCH) {
+            for (const auto& r : visibleVertices) run(r.first, r.second);
+            gather(0, visibleShared.size());
+            return;
+        }
+        // Range jobs first, then slices of the shared list
+        splitRanges(visibleVertices, VERTEX_BATCH, jobs);
+        const size_t rangeJobs = jobs.size();
+        splitRanges({{0, visibleShared.size()}}, VERTEX_BATCH, gatherJobs);
+        pool->parallelFor(rangeJobs + gatherJobs.size(), [&](size_t b) {
+            TraceScope trace("transform batch");
+            if (b < rangeJobs) run(jobs[b].first, jobs[b].second);
+            else gather(gatherJobs[b - rangeJobs].first, gatherJobs[b - rangeJobs].second);
+        });
+    }
+
+    // Triangle setup and scan conversion of the clusters found visible by
+    // the last transformVertices call
+    void rasterize(const Mesh& mesh) { rasterize(mesh, mesh.texture); }
+
+    void rasterize(const Mesh& mesh, const Texture& texture) {
+        ScopedTimer timer(profiling ? &times.raster : nullptr);
+        TraceScope trace("raster");
         clear();
         
-        const Texture* tex = mesh.texture.width > 0 ? &mesh.texture : nullptr;
-        for (const auto& tri : mesh.triangles) {
-            Vec3 p0 = mesh.vertices[tri.v0];
-            Vec3 p1 = mesh.vertices[tri.v1];
-            Vec3 p2 = mesh.vertices[tri.v2];
-
-            Vec3 n0, n1, n2;
-            if (tri.n0 >= 0 && tri.n1 >= 0 && tri.n2 >= 0) {
-                n0 = mesh.normals[tri.n0];
-                n1 = mesh.normals[tri.n1];
-                n2 = mesh.normals[tri.n2];
-            } else {
-                Vec3 n = (p1 - p0).cross(p2 - p0).normalized();
-                n0 = n1 = n2 = n;
+        const Texture* tex = texture.width > 0 ? &texture : nullptr;
+        frame.hasColor = tex != nullptr;
+        stats = RasterStats();
+        stats.trianglesSubmitted = mesh.triangles.size();
+        stats.clustersCulled = clustersCulled;
+        stats.trianglesCulled = mesh.triangles.size();
+        for (const auto& r : visibleTriangles) stats.trianglesCulled -= r.second - r.first;
+        if (mesh.faceNormals.size() == mesh.triangles.size()) {
+            faceNormals = mesh.faceNormals.data();
+        } else {
+            ownNormals.resize(mesh.triangles.size());
+            for (size_t i = 0; i < mesh.triangles.size(); i++) {
+                const Triangle& t = mesh.triangles[i];
+                ownNormals[i] = Mesh::faceNormal(mesh.vertices[t.v0], mesh.vertices[t.v1], mesh.vertices[t.v2]);
             }
+            faceNormals = ownNormals.data();
+        }
+        if (pool) {
+            renderTiled(mesh, tex);
+            return;
+        }
+        ScreenTriangle st[MAX_CLIPPED];
+        for (const auto& r : visibleTriangles) {
+            for (size_t i = r.first; i < r.second; i++) {
+                bool clipped;
+                int count = setupMeshTriangle(mesh, i, st, clipped);
+                if (clipped) stats.trianglesClipped++;
+                if (count == 0) stats.trianglesCulled++;
+                for (int k = 0; k < count; k++) drawTriangle(st[k], tex, 0, 0, width - 1, height - 1, stats);
+            }
+        }
+    }
+
+    // Skip mesh clusters outside the view frustum or facing away from the
+    // camera (the default). The image is identical either way, except for
+    // sub-pixel back faces whose winding flips when snapped to the raster
+    // grid; culled clusters no longer get the chance to draw those.
+    void setClusterCulling(bool enable) { useClusters = enable; }
 
-            double u0 = 0, v0 = 0, u1 = 0, v1 = 0, u2 = 0, v2 = 0;
-            if (tri.t0 >= 0 && tri.t1 >= 0 && tri.t2 >= 0 && tri.t0 < (int)mesh.texCoords.size() &&
-                tri.t1 < (int)mesh.texCoords.size() && tri.t2 < (int)mesh.texCoords.size()) {
-                u0 = mesh.texCoords[tri.t0].u; v0 = mesh.texCoords[tri.t0].v;
-                u1 = mesh.texCoords[tri.t1].u; v1 = mesh.texCoords[tri.t1].v;
-                u2 = mesh.texCoords[tri.t2].u; v2 = mesh.texCoords[tri.t2].v;
+    // Clip-space positions from the last frame's vertex stage, indexed like
+    // the mesh's vertices; only those of drawn clusters are current
+    const std::vector<Vec4f>& clipPositions() const { return clip; }
+
+private:
+    int tilesX, tilesY;
+    bool simd = cpuHasAvx();
+    bool useCoarse = true;
+    bool useSmall = true;
+    bool profiling = false;
+    bool useClusters = true;
+    std::vector<RasterStats> tileStats;
+    std::vector<Vec4f> clip;  // clip-space position of every visible mesh vertex this frame
+
+    // Ascending [begin, end) ranges of the visible clusters, their triangles
+    // and the vertices they own, from findVisible
+    using Range = std::pair<size_t, size_t>;
+    std::vector<Range> visibleClusters, visibleTriangles, visibleVertices, jobs, gatherJobs;
+    // Vertices visible clusters share with culled ones, ascending
+    std::vector<uint32_t> visibleShared;
+    std::vector<uint8_t> clusterVisible;
+    uint64_t clustersCulled = 0;
+
+    // The mesh's face normals, or ownNormals for meshes that lack them
+    const Vec3* faceNormals = nullptr;
+    std::vector<Vec3> ownNormals;
+
+    void findVisible(const Mesh& mesh) {
+        visibleClusters.clear();
+        visibleTriangles.clear();
+        visibleVertices.clear();
+        visibleShared.clear();
+        clustersCulled = 0;
+        const ClusterBvh& bvh = mesh.clusters;
+        if (!useClusters || bvh.empty() || bvh.clusters.back().triangleEnd != mesh.triangles.size()) {
+            visibleTriangles.push_back({0, mesh.triangles.size()});
+            visibleVertices.push_back({0, mesh.vertices.size()});
+            return;
+        }
+        // Owned vertex ranges of consecutive clusters are adjacent, so runs
+        // of clusters give single ranges of both
+        auto append = [](std::vector<Range>& ranges, size_t begin, size_t end) {
+            if (!ranges.empty() && ranges.back().second == begin) ranges.back().second = end;
+            else ranges.push_back({begin, end});
+        };
+        size_t kept = 0;
+        clusterVisible.assign(bvh.clusters.size(), 0);
+        bvh.cull(viewProj, [&](uint32_t first, uint32_t end) {
+            kept += end - first;
+            visibleClusters.push_back({first, end});
+            append(visibleTriangles, bvh.clusters[first].firstTriangle, bvh.clusters[end - 1].triangleEnd);
+            append(visibleVertices, bvh.clusters[first].firstVertex, bvh.clusters[end - 1].vertexEnd);
+            std::fill(clusterVisible.begin() + first, clusterVisible.begin() + end, 1);
+        });
+        clustersCulled = bvh.clusters.size() - kept;
+
+        // Shared vertices whose owner was culled; the others are already
+        // in an owned range
+        for (const Range& r : visibleClusters) {
+            for (size_t c = r.first; c < r.second; c++) {
+                const MeshCluster& cl = bvh.clusters[c];
+                for (uint32_t k = cl.firstShared; k < cl.sharedEnd; k++)
+                    if (!clusterVisible[bvh.sharedOwners[k]]) visibleShared.push_back(bvh.sharedVertices[k]);
             }
+        }
+        std::sort(visibleShared.begin(), visibleShared.end());
+        visibleShared.erase(std::unique(visibleShared.begin(), visibleShared.end()), visibleShared.end());
+    }
 
-            rasterizeTriangle(p0, p1, p2, n0, n1, n2, u0, v0, u1, v1, u2, v2, tex);
+    // Cut ranges into pieces of at most size elements, in order
+    static void splitRanges(const std::vector<Range>& ranges, size_t size, std::vector<Range>& out) {
+        out.clear();
+        for (const Range& r : ranges)
+            for (size_t begin = r.first; begin < r.second; begin += size)
+                out.push_back({begin, std::min(r.second, begin + size)});
+    }
+    std::unique_ptr<ThreadPool> pool;
+
+    // Per geometry batch: set-up triangles and, per tile, the indices of the
+    // ones overlapping it. Kept across frames to reuse their storage.
+    struct Batch {
+        std::vector<ScreenTriangle> triangles;
+        std::vector<std::vector<uint32_t>> bins;
+        uint64_t culled = 0, clipped = 0;  // mesh triangles
+    };
+    std::vector<Batch> batches;
+
+    // Geometry pass bins triangles to tiles batch by batch; the raster pass
+    // then walks every tile's bins in batch order, so each pixel sees its
+    // triangles in mesh order and depth ties resolve as in the serial path.
+    void renderTiled(const Mesh& mesh, const Texture* tex) {
+        size_t tileCount = static_cast<size_t>(tilesX) * tilesY;
+        splitRanges(visibleTriangles, GEOMETRY_BATCH, jobs);
+        size_t batchCount = jobs.size();
+        if (batches.size() < batchCount) batches.resize(batchCount);
+
+        pool->parallelFor(batchCount, [&](size_t b) {
+            TraceScope trace("setup batch");
+            Batch& batch = batches[b];
+            batch.triangles.clear();
+            batch.bins.resize(tileCount);
+            for (auto& bin : batch.bins) bin.clear();
+            batch.culled = batch.clipped = 0;
+
+            ScreenTriangle sts[MAX_CLIPPED];
+            for (size_t i = jobs[b].first; i < jobs[b].second; i++) {
+                bool clipped;
+                int count = setupMeshTriangle(mesh, i, sts, clipped);
+                if (clipped) batch.clipped++;
+                if (count == 0) batch.culled++;
+                for (int k = 0; k < count; k++) {
+                    const ScreenTriangle& st = sts[k];
+                    uint32_t index = static_cast<uint32_t>(batch.triangles.size());
+                    batch.triangles.push_back(st);
+                    for (int ty = st.minY / TILE_H; ty <= st.maxY / TILE_H; ty++)
+                        for (int tx = st.minX / TILE_W; tx <= st.maxX / TILE_W; tx++)
+                            batch.bins[ty * tilesX + tx].push_back(index);
+                }
+            }
+        });
+
+        tileStats.assign(tileCount, RasterStats());
+        pool->parallelFor(tileCount, [&](size_t t) {
+            TraceScope trace("raster tile");
+            int tx = static_cast<int>(t % tilesX), ty = static_cast<int>(t / tilesX);
+            int x0 = tx * TILE_W, y0 = ty * TILE_H;
+            int x1 = std::min(width, x0 + TILE_W) - 1, y1 = std::min(height, y0 + TILE_H) - 1;
+            for (size_t b = 0; b < batchCount; b++) {
+                const Batch& batch = batches[b];
+                for (uint32_t index : batch.bins[t])
+                    drawTriangle(batch.triangles[index], tex, x0, y0, x1, y1, tileStats[t]);
+            }
+        });
+        for (const auto& ts : tileStats) stats.add(ts);
+        for (size_t b = 0; b < batchCount; b++) {
+            stats.trianglesCulled += batches[b].culled;
+            stats.trianglesClipped += batches[b].clipped;
         }
     }
 };
@@ -4,6 +4,7 @@
 #include <string>
 #include <algorithm>
 #include <cmath>
+#include "trace.hpp"
 
 extern "C" unsigned char* stbi_load(char const* filename, int* x, int* y, int* channels_in_file, int desired_channels);
 extern "C" void stbi_image_free(void* retval_from_stbi_load);
@@ -13,6 +14,7 @@ struct Texture {
     int width = 0, height = 0, channels = 0;
 
     bool load(const std::string& path) {
+        TraceScope trace("Texture::load");
         int w, h, n;
         unsigned char* img = stbi_load(path.c_str(), &w, &h, &n, 3);
         if (!img) return false;
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running index-parallel jobs
+class ThreadPool {
+public:
+    // threads == 0 uses every hardware thread; the caller counts as one
+    explicit ThreadPool(unsigned threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 1; i < threads; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeCv.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    // Call fn(i) for every i in [0, count) and return once all calls are done.
+    // The calling thread takes part; calls must not nest.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+        if (count == 0) return;
+        if (workers.empty() || count == 1) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &fn;
+        jobCount = count;
+        next = 0;
+        done = 0;
+        generation++;
+        lock.unlock();
+        wakeCv.notify_all();
+
+        runJob(fn, count);
+
+        lock.lock();
+        doneCv.wait(lock, [&] { return done == count && active == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wakeCv, doneCv;
+    const std::function<void(size_t)>* job = nullptr;
+    size_t jobCount = 0;
+    size_t generation = 0;
+    unsigned active = 0;
+    bool stopping = false;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+
+    void runJob(const std::function<void(size_t)>& fn, size_t count) {
+        size_t i;
+        while ((i = next.fetch_add(1)) < count) {
+            fn(i);
+            if (done.fetch_add(1) + 1 == count) {
+                std::lock_guard<std::mutex> lock(mutex);
+                doneCv.notify_all();
+            }
+        }
+    }
+
+    void workerLoop() {
+        Trace::setThreadName("pool worker");
+        size_t seen = 0;
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCv.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            if (!job) continue;
+            const std::function<void(size_t)>* fn = job;
+            size_t count = jobCount;
+            active++;
+            lock.unlock();
+
+            runJob(*fn, count);
+
+            lock.lock();
+            active--;
+            if (active == 0) doneCv.notify_all();
+        }
+    }
+};
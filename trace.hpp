@@ -0,0 +1,131 @@
+#pragma once
+
+#include "profile.hpp"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records begin/end events into a Chrome trace JSON file (chrome://tracing,
+// Perfetto). Every thread appends to its own buffer without locking; the
+// registry lock is only taken the first time a thread records. write() reads
+// all buffers, so call it once traced threads are idle or joined.
+class Trace {
+public:
+    static constexpr size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+    static void start() {
+        State& s = state();
+        s.origin = nowSeconds();
+        s.enabled.store(true, std::memory_order_release);
+    }
+
+    static bool enabled() { return state().enabled.load(std::memory_order_relaxed); }
+
+    // Label the calling thread in the viewer; a no-op while tracing is off
+    static void setThreadName(const char* name) {
+        if (enabled()) buffer().name = name;
+    }
+
+    // Times are nowSeconds() values
+    static void record(const char* name, double begin, double end) {
+        ThreadBuffer& b = buffer();
+        if (b.events.size() >= MAX_EVENTS_PER_THREAD) {
+            b.dropped++;
+            return;
+        }
+        b.events.push_back({name, begin, end});
+    }
+
+    static bool write(const std::string& path) {
+        State& s = state();
+        FILE* f = std::fopen(path.c_str(), "w");
+        if (!f) return false;
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        for (const auto& t : s.threads) {
+            std::fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"",
+                         first ? "" : ",\n", t->id);
+            if (t->name.empty()) std::fprintf(f, "thread %d", t->id);
+            else writeEscaped(f, t->name);
+            std::fprintf(f, "\"}}");
+            first = false;
+            for (const Event& e : t->events) {
+                std::fprintf(f, ",\n{\"name\":\"");
+                writeEscaped(f, e.name);
+                std::fprintf(f, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", t->id,
+                             (e.begin - s.origin) * 1e6, (e.end - e.begin) * 1e6);
+            }
+            if (t->dropped)
+                std::fprintf(stderr, "trace: thread %d dropped %zu events\n", t->id, t->dropped);
+        }
+        std::fprintf(f, "\n]}\n");
+        return std::fclose(f) == 0;
+    }
+
+private:
+    struct Event {
+        const char* name;  // string literal
+        double begin, end;
+    };
+
+    struct ThreadBuffer {
+        int id = 0;
+        std::string name;
+        std::vector<Event> events;
+        size_t dropped = 0;
+    };
+
+    struct State {
+        std::atomic<bool> enabled{false};
+        double origin = 0;
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> threads;  // outlive their threads
+    };
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+
+    static ThreadBuffer& buffer() {
+        thread_local ThreadBuffer* b = nullptr;
+        if (!b) {
+            State& s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.threads.emplace_back(new ThreadBuffer);
+            b = s.threads.back().get();
+            b->id = static_cast<int>(s.threads.size());
+            b->events.reserve(4096);
+        }
+        return *b;
+    }
+
+    static void writeEscaped(FILE* f, const std::string& text) {
+        for (char c : text) {
+            if (c == '"' || c == '\\') std::fputc('\\', f);
+            if (static_cast<unsigned char>(c) >= 0x20) std::fputc(c, f);
+        }
+    }
+};
+
+// Records the enclosing scope as one event; costs a flag check when tracing
+// is off. name must be a string literal.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name)
+        : name(Trace::enabled() ? name : nullptr), start(this->name ? nowSeconds() : 0) {}
+    ~TraceScope() {
+        if (name) Trace::record(name, start, nowSeconds());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    double start;
+};